@@ -0,0 +1,137 @@
+// Compares two diagnostics time series (diag_file) written by runs of the same
+// problem, e.g. the all-double and the mixed-precision build, and reports the
+// largest differences of the averaged magnetization and the energies.
+//
+//   compare_diagnostics <reference.csv> <test.csv> <Ms> [report.json]
+//
+// Rows are matched by step.  M differences are relative to Ms, energy differences
+// relative to max |E_total| of the reference.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// step,time,Mx_avg,My_avg,Mz_avg,E_exchange,E_anisotropy,E_zeeman,E_demag,E_total,max_torque
+constexpr int ncols = 11;
+const char* col_names[ncols] = {"step", "time", "Mx_avg", "My_avg", "Mz_avg", "E_exchange",
+                                "E_anisotropy", "E_zeeman", "E_demag", "E_total", "max_torque"};
+
+bool ReadSeries (const std::string& file, std::map<long, std::vector<double> >& rows)
+{
+    std::ifstream ifs(file);
+    if (!ifs.good()) {
+        std::cerr << "compare_diagnostics: cannot open " << file << "\n";
+        return false;
+    }
+
+    std::string line;
+    std::getline(ifs, line); // header
+    while (std::getline(ifs, line))
+    {
+        if (line.empty()) continue;
+        std::vector<double> v;
+        std::istringstream is(line);
+        std::string field;
+        while (std::getline(is, field, ',')) v.push_back(std::stod(field));
+        if (v.size() != ncols) {
+            std::cerr << "compare_diagnostics: " << file << ": expected " << ncols << " columns\n";
+            return false;
+        }
+        // a restart appends from the checkpoint step; the last row of a step wins
+        rows[static_cast<long>(v[0])] = v;
+    }
+    return true;
+}
+
+}
+
+int main (int argc, char* argv[])
+{
+    if (argc < 4) {
+        std::cerr << "usage: compare_diagnostics <reference.csv> <test.csv> <Ms> [report.json]\n";
+        return 2;
+    }
+
+    std::map<long, std::vector<double> > ref, test;
+    if (!ReadSeries(argv[1], ref) || !ReadSeries(argv[2], test)) return 1;
+    double const Ms = std::stod(argv[3]);
+
+    double E_scale = 0.;
+    for (auto const& r : ref) E_scale = std::max(E_scale, std::abs(r.second[9]));
+    if (E_scale <= 0.) E_scale = 1.;
+
+    // max difference of each column over the common steps, and where it occurred
+    double max_diff[ncols] = {0.};
+    long at_step[ncols] = {0};
+    long ncommon = 0;
+    long last_step = -1;
+    for (auto const& r : ref)
+    {
+        auto t = test.find(r.first);
+        if (t == test.end()) continue;
+        ++ncommon;
+        last_step = r.first;
+        for (int c = 2; c < ncols; c++)
+        {
+            double const scale = (c <= 4 || c == 10) ? Ms : E_scale;
+            double const d = std::abs(t->second[c] - r.second[c]) / scale;
+            if (d > max_diff[c]) {
+                max_diff[c] = d;
+                at_step[c] = r.first;
+            }
+        }
+    }
+
+    if (ncommon == 0) {
+        std::cerr << "compare_diagnostics: no common steps\n";
+        return 1;
+    }
+
+    double max_dM = 0.;
+    for (int c = 2; c <= 4; c++) max_dM = std::max(max_dM, max_diff[c]);
+
+    std::cout.precision(4);
+    std::cout << std::scientific;
+    std::cout << "Compared " << ncommon << " steps up to step " << last_step << "\n";
+    for (int c = 2; c < ncols; c++)
+    {
+        std::cout << "  " << col_names[c] << ": max difference " << max_diff[c]
+                  << ((c <= 4 || c == 10) ? " of Ms" : " of max |E_total|")
+                  << " at step " << at_step[c] << "\n";
+    }
+    std::cout << "  final E_total: reference " << ref[last_step][9] << " J, test " << test[last_step][9] << " J\n";
+
+    if (argc > 4)
+    {
+        std::ofstream ofs(argv[4], std::ofstream::out | std::ofstream::trunc);
+        if (!ofs.good()) {
+            std::cerr << "compare_diagnostics: cannot write " << argv[4] << "\n";
+            return 1;
+        }
+        ofs.precision(8);
+        ofs << "{\n"
+            << "  \"steps_compared\": " << ncommon << ",\n"
+            << "  \"last_step\": " << last_step << ",\n"
+            << "  \"max_dM_avg_over_Ms\": " << max_dM << ",\n"
+            << "  \"max_dE_total_rel\": " << max_diff[9] << ",\n"
+            << "  \"final_E_total_reference\": " << ref[last_step][9] << ",\n"
+            << "  \"final_E_total_test\": " << test[last_step][9] << ",\n"
+            << "  \"columns\": {\n";
+        for (int c = 2; c < ncols; c++)
+        {
+            ofs << "    \"" << col_names[c] << "\": {\"max_diff\": " << max_diff[c]
+                << ", \"step\": " << at_step[c] << "}" << ((c + 1 < ncols) ? "," : "") << "\n";
+        }
+        ofs << "  }\n"
+            << "}\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+# Runs the micromag_bench workloads (cmake -P, invoked by the micromag_bench target).
+#
+#   MICROMAG_EXE  executable
+#   LAUNCHER      optional MPI launcher command (list)
+#   NSTEPS        time steps per workload
+#   SOURCE_DIR    source tree, for the inputs files
+#   BENCH_DIR     work directory; each workload runs in BENCH_DIR/<name>
+#
+# Every workload writes its PerfMonitor summary (perf_file) on the last step; the
+# summaries are printed as a table and collected into BENCH_DIR/micromag_bench.json.
+
+cmake_minimum_required(VERSION 3.20)
+
+foreach (_var MICROMAG_EXE NSTEPS SOURCE_DIR BENCH_DIR)
+   if (NOT DEFINED ${_var})
+      message(FATAL_ERROR "RunBench.cmake: ${_var} is not set")
+   endif ()
+endforeach ()
+
+# output, checkpoints and early stopping off; one summary at the last step
+set(_common
+   "nsteps=${NSTEPS}" "plot_int=-1" "chk_int=-1" "diag_int=-1" "stop_int=-1" "relax=0"
+   "perf_int=${NSTEPS}" "perf_file=perf.json" "mem_report=0" "amrex.async_out=0")
+
+set(_workloads sp4 micromag micromag_128 micromag_256)
+
+set(sp4_inputs ${SOURCE_DIR}/Exec/bench/inputs_sp4)
+set(sp4_args "")
+
+set(micromag_inputs ${SOURCE_DIR}/Exec/inputs_micromag)
+set(micromag_args "")
+
+# the shipped case with the domain and magnet scaled so that the cell size is unchanged
+set(micromag_128_inputs ${SOURCE_DIR}/Exec/inputs_micromag)
+set(micromag_128_args
+   "n_cell=128 128 128" "max_grid_size=64"
+   "prob_lo=-32.e-9 -32.e-9 0.0" "prob_hi=32.e-9 32.e-9 64.e-9"
+   "mag_lo=-24.e-9 -16.e-9 32.e-9" "mag_hi=24.e-9 16.e-9 40.e-9")
+
+set(micromag_256_inputs ${SOURCE_DIR}/Exec/inputs_micromag)
+set(micromag_256_args
+   "n_cell=256 256 256" "max_grid_size=64"
+   "prob_lo=-64.e-9 -64.e-9 0.0" "prob_hi=64.e-9 64.e-9 128.e-9"
+   "mag_lo=-48.e-9 -32.e-9 64.e-9" "mag_hi=48.e-9 32.e-9 80.e-9")
+
+set(_phases field_assembly update normalize halo_exchange demag io)
+
+set(_summary "{\n  \"nsteps\": ${NSTEPS},\n  \"workloads\": {")
+set(_sep "")
+set(_failed "")
+
+foreach (_name IN LISTS _workloads)
+   set(_dir ${BENCH_DIR}/${_name})
+   file(REMOVE_RECURSE ${_dir})
+   file(MAKE_DIRECTORY ${_dir})
+
+   message(STATUS "micromag_bench: ${_name}")
+   execute_process(
+      COMMAND ${LAUNCHER} ${MICROMAG_EXE} ${${_name}_inputs} ${_common} ${${_name}_args}
+      WORKING_DIRECTORY ${_dir}
+      OUTPUT_FILE ${_dir}/run.log
+      ERROR_FILE ${_dir}/run.log
+      RESULT_VARIABLE _rc)
+
+   if (NOT _rc EQUAL 0 OR NOT EXISTS ${_dir}/perf.json)
+      message(SEND_ERROR "micromag_bench: ${_name} failed (${_rc}), see ${_dir}/run.log")
+      list(APPEND _failed ${_name})
+      continue()
+   endif ()
+
+   file(READ ${_dir}/perf.json _json)
+
+   string(JSON _rate GET ${_json} cell_updates_per_second)
+   string(JSON _loop GET ${_json} loop_time)
+   string(JSON _fab GET ${_json} peak_fab_MB)
+   string(JSON _rss GET ${_json} peak_rss_MB)
+   message("  cell updates/s ${_rate}, loop ${_loop} s, peak FAB ${_fab} MB, peak RSS ${_rss} MB")
+   foreach (_phase IN LISTS _phases)
+      string(JSON _time GET ${_json} phases ${_phase} time)
+      string(JSON _frac GET ${_json} phases ${_phase} fraction_of_loop)
+      message("    ${_phase}: ${_time} s (${_frac} of loop)")
+   endforeach ()
+
+   string(STRIP "${_json}" _json)
+   string(APPEND _summary "${_sep}\n    \"${_name}\": ${_json}")
+   set(_sep ",")
+endforeach ()
+
+string(APPEND _summary "\n  }\n}\n")
+file(WRITE ${BENCH_DIR}/micromag_bench.json "${_summary}")
+message(STATUS "micromag_bench: results in ${BENCH_DIR}/micromag_bench.json")
+
+if (_failed)
+   message(FATAL_ERROR "micromag_bench: failed workloads: ${_failed}")
+endif ()
@@ -0,0 +1,69 @@
+# Accuracy report of the mixed-precision build (cmake -P, invoked by the
+# micromag_precision_report target).
+#
+#   DOUBLE_EXE    all-double executable (reference)
+#   MIXED_EXE     executable built with MICROMAG_MIXED_PRECISION
+#   COMPARE_EXE   compare_diagnostics
+#   LAUNCHER      optional MPI launcher command (list)
+#   NSTEPS        time steps
+#   DIAG_INT      steps between diagnostics rows
+#   SOURCE_DIR    source tree, for the inputs file
+#   REPORT_DIR    work directory; each build runs in REPORT_DIR/<build>
+#
+# Both builds run standard problem #4 (Exec/bench/inputs_sp4) from the same initial
+# state; the diagnostics time series are compared row by row and the summary is
+# written to REPORT_DIR/precision_report.json.
+
+cmake_minimum_required(VERSION 3.20)
+
+foreach (_var DOUBLE_EXE MIXED_EXE COMPARE_EXE NSTEPS DIAG_INT SOURCE_DIR REPORT_DIR)
+   if (NOT DEFINED ${_var})
+      message(FATAL_ERROR "RunPrecisionReport.cmake: ${_var} is not set")
+   endif ()
+endforeach ()
+
+set(_inputs ${SOURCE_DIR}/Exec/bench/inputs_sp4)
+
+# the diagnostics time series and one performance summary, nothing else
+set(_args
+   "nsteps=${NSTEPS}" "plot_int=-1" "chk_int=-1" "diag_int=${DIAG_INT}" "diag_file=diagnostics.csv"
+   "stop_int=-1" "relax=0" "perf_int=${NSTEPS}" "perf_file=perf.json" "mem_report=0")
+
+foreach (_build double mixed)
+   string(TOUPPER ${_build} _BUILD)
+   set(_dir ${REPORT_DIR}/${_build})
+   file(REMOVE_RECURSE ${_dir})
+   file(MAKE_DIRECTORY ${_dir})
+
+   message(STATUS "micromag_precision_report: ${_build}")
+   execute_process(
+      COMMAND ${LAUNCHER} ${${_BUILD}_EXE} ${_inputs} ${_args}
+      WORKING_DIRECTORY ${_dir}
+      OUTPUT_FILE ${_dir}/run.log
+      ERROR_FILE ${_dir}/run.log
+      RESULT_VARIABLE _rc)
+
+   if (NOT _rc EQUAL 0 OR NOT EXISTS ${_dir}/diagnostics.csv)
+      message(FATAL_ERROR "micromag_precision_report: ${_build} run failed (${_rc}), see ${_dir}/run.log")
+   endif ()
+
+   if (EXISTS ${_dir}/perf.json)
+      file(READ ${_dir}/perf.json _json)
+      string(JSON _rate GET ${_json} cell_updates_per_second)
+      message("  ${_build}: ${_rate} cell updates/s")
+   endif ()
+endforeach ()
+
+# Ms of the inputs file is the scale of the M differences
+file(STRINGS ${_inputs} _ms_line REGEX "^Ms_val")
+string(REGEX REPLACE "^Ms_val *= *([^ #]+).*" "\\1" _Ms "${_ms_line}")
+
+execute_process(
+   COMMAND ${COMPARE_EXE} ${REPORT_DIR}/double/diagnostics.csv ${REPORT_DIR}/mixed/diagnostics.csv ${_Ms}
+           ${REPORT_DIR}/precision_report.json
+   RESULT_VARIABLE _rc)
+
+if (NOT _rc EQUAL 0)
+   message(FATAL_ERROR "micromag_precision_report: comparison failed (${_rc})")
+endif ()
+message(STATUS "micromag_precision_report: results in ${REPORT_DIR}/precision_report.json")
@@ -0,0 +1,731 @@
+#include "AmrMicroMag.H"
+#include "Diagnostics.H"
+
+#include <AMReX_FillPatchUtil.H>
+#include <AMReX_Interpolater.H>
+#include <AMReX_MultiFabUtil.H>
+#include <AMReX_ParmParse.H>
+#include <AMReX_PhysBCFunct.H>
+#include <AMReX_PlotFileUtil.H>
+
+#include <limits>
+#include <utility>
+
+// The interpolaters work on Real FABs, so AMR mode is only built when M is stored in Real
+#ifndef MICROMAG_MIXED_PRECISION
+
+namespace {
+
+// Ghost cells outside the domain are only extrapolated (BCType::foextrap), which
+// GpuBndryFuncFab does itself; there are no Dirichlet boundaries to fill
+struct NoExtDirFill
+{
+    AMREX_GPU_DEVICE
+    void operator() (const IntVect& /*iv*/, Array4<Real> const& /*dest*/,
+                     int /*dcomp*/, int /*numcomp*/, GeometryData const& /*geom*/,
+                     Real /*time*/, const BCRec* /*bcr*/, int /*bcomp*/,
+                     int /*orig_comp*/) const {}
+};
+
+using AmrPhysBC = PhysBCFunct<GpuBndryFuncFab<NoExtDirFill> >;
+
+int AmrMaxLevel ()
+{
+    int max_level = 1;
+    ParmParse("amr").query("max_level", max_level);
+    return max_level;
+}
+
+// the components of a 3-component state as single-component aliases, the layout the
+// LLG kernels take
+Array<MultiFab, AMREX_SPACEDIM> Components (MultiFab& mf)
+{
+    return {AMREX_D_DECL(MultiFab(mf, amrex::make_alias, 0, 1),
+                         MultiFab(mf, amrex::make_alias, 1, 1),
+                         MultiFab(mf, amrex::make_alias, 2, 1))};
+}
+
+}
+
+AmrMicroMag::AmrMicroMag (const RealBox& real_box, const Vector<int>& n_cell,
+                          const Array<int, AMREX_SPACEDIM>& is_periodic,
+                          int max_grid_size, Real mu0,
+                          int demag_coupling, int exchange_coupling, int anisotropy_coupling,
+                          int M_normalization, GpuArray<Real, 3> anisotropy_axis,
+                          int TimeIntegratorOrder)
+    : AmrCore(real_box, AmrMaxLevel(), n_cell, CoordSys::cartesian, Vector<IntVect>(), is_periodic),
+      m_mu0(mu0),
+      m_demag_coupling(demag_coupling),
+      m_exchange_coupling(exchange_coupling),
+      m_anisotropy_coupling(anisotropy_coupling),
+      m_M_normalization(M_normalization),
+      m_anisotropy_axis(anisotropy_axis),
+      m_order(TimeIntegratorOrder)
+{
+    ParmParse pa("amr");
+    pa.query("regrid_int", m_regrid_int);
+    pa.query("tag_grad_m", m_tag_grad_m);
+    pa.query("tag_exchange_energy", m_tag_exchange_energy);
+    pa.query("subcycling", m_subcycling);
+
+    // the grids of the single-level run unless amr.max_grid_size is given
+    if (!pa.contains("max_grid_size")) SetMaxGridSize(max_grid_size);
+
+    if (m_order == 5) {
+        amrex::Abort("amr = 1 takes fixed steps on every level; use TimeIntegratorOrder = 1, 2 or 4");
+    }
+
+    int const nlevs_max = max_level + 1;
+
+    m_M_new.resize(nlevs_max);
+    m_M_old.resize(nlevs_max);
+    m_t_new.resize(nlevs_max, 0.);
+    m_t_old.resize(nlevs_max, -1.e200);
+    m_dt.resize(nlevs_max, 0.);
+    m_istep.resize(nlevs_max, 0);
+    m_last_regrid_step.resize(nlevs_max, 0);
+    m_nsubsteps.resize(nlevs_max, 1);
+    for (int lev = 1; lev <= max_level; ++lev) {
+        m_nsubsteps[lev] = (m_subcycling == 1) ? MaxRefRatio(lev-1) : 1;
+    }
+
+    m_coarse_ghost.resize(nlevs_max);
+    m_H.resize(nlevs_max);
+    m_materials.resize(nlevs_max);
+    m_stencil.resize(nlevs_max);
+    m_applied.resize(nlevs_max);
+    m_thermal.resize(nlevs_max);
+    m_integrator.resize(nlevs_max);
+
+    m_bcs.resize(AMREX_SPACEDIM);
+    for (int n = 0; n < AMREX_SPACEDIM; ++n)
+    {
+        for (int idim = 0; idim < AMREX_SPACEDIM; ++idim)
+        {
+            int const bc = is_periodic[idim] ? BCType::int_dir : BCType::foextrap;
+            m_bcs[n].setLo(idim, bc);
+            m_bcs[n].setHi(idim, bc);
+        }
+    }
+}
+
+AmrMicroMag::~AmrMicroMag () = default;
+
+void AmrMicroMag::InitData ()
+{
+    InitFromScratch(0.0);
+
+    m_materials[0]->checkCouplings(m_exchange_coupling, m_anisotropy_coupling);
+
+    if (m_thermal[0].enabled() && m_order != 2) {
+        amrex::Abort("temperature > 0 needs the stochastic Heun scheme: TimeIntegratorOrder = 2");
+    }
+
+    m_llg_rhs = SelectLLGRHS(m_demag_coupling, m_exchange_coupling, m_anisotropy_coupling,
+                             m_M_normalization, m_thermal[0].enabled());
+
+    if (m_demag_coupling == 1)
+    {
+        m_demag = std::make_unique<Demagnetization>(Geom(0), maxGridSize(0).max());
+    }
+
+    amrex::Print() << "==================== AMR Setup ====================\n";
+    amrex::Print() << " demag_coupling      = " << m_demag_coupling      << "\n";
+    amrex::Print() << " M_normalization     = " << m_M_normalization     << "\n";
+    amrex::Print() << " exchange_coupling   = " << m_exchange_coupling   << "\n";
+    amrex::Print() << " anisotropy_coupling = " << m_anisotropy_coupling << "\n";
+    amrex::Print() << " max_level           = " << max_level             << "\n";
+    amrex::Print() << " regrid_int          = " << m_regrid_int          << "\n";
+    amrex::Print() << " tag_grad_m          = " << m_tag_grad_m          << "\n";
+    amrex::Print() << " tag_exchange_energy = " << m_tag_exchange_energy << " J/m^3\n";
+    amrex::Print() << " subcycling          = " << m_subcycling          << "\n";
+    m_materials[0]->print();
+    m_applied[0].print();
+    m_thermal[0].print();
+    PrintGrids();
+    amrex::Print() << "===================================================\n";
+}
+
+void AmrMicroMag::Evolve (int nsteps, Real dt, Real stop_time, int plot_int,
+                          int diag_int, const std::string& diag_file)
+{
+    // explicit exchange limits dt on every level that can be built; with subcycling a
+    // level's limit is multiplied by the substeps it takes per step of level 0
+    if (m_exchange_coupling == 1)
+    {
+        Real dt_exchange = std::numeric_limits<Real>::max();
+        Real substeps = 1.;
+        for (int lev = 0; lev <= max_level; ++lev)
+        {
+            substeps *= m_nsubsteps[lev];
+            Real const dt_lev = StableDt(lev);
+            if (dt_lev <= 0.) {
+                dt_exchange = dt_lev;
+                break;
+            }
+            dt_exchange = amrex::min(dt_exchange, dt_lev * substeps);
+        }
+
+        if (dt_exchange > 0.) {
+            amrex::Print() << "Exchange stability limit dt = " << dt_exchange << " on level 0\n";
+            if (dt > dt_exchange) {
+                amrex::Print() << "Reducing dt from " << dt << " to the exchange stability limit\n";
+                dt = dt_exchange;
+            }
+        } else {
+            amrex::Print() << "Warning: TimeIntegratorOrder " << m_order
+                           << " is unstable for undamped exchange modes at any dt\n";
+        }
+    }
+
+    // diagnostics of level 0, which holds the average of the finer levels
+    auto CurrentDiagnostics = [&] (Real time)
+    {
+        Array<MultiFab, AMREX_SPACEDIM> M = Components(m_M_new[0]);
+        FillGhostCells(0, M, time);
+
+        Array<MultiFab, AMREX_SPACEDIM> H;
+        if (m_demag_coupling == 1)
+        {
+            H = Components(m_H[0]);
+            m_demag->ComputeHDemag(M, H);
+        }
+        return ComputeDiagnostics(M, H, m_applied[0], time, *m_materials[0], *m_stencil[0],
+                                  m_demag_coupling, m_exchange_coupling, m_anisotropy_coupling,
+                                  m_mu0, m_anisotropy_axis, Geom(0));
+    };
+
+    Real time = m_t_new[0];
+
+    if (plot_int > 0) WritePlotFile(0);
+
+    if (diag_int > 0)
+    {
+        InitDiagnosticsFile(diag_file, false);
+        WriteDiagnostics(diag_file, 0, time, CurrentDiagnostics(time));
+    }
+
+    for (int step = 1; step <= nsteps; ++step)
+    {
+        Real step_strt_time = ParallelDescriptor::second();
+
+        Real dt_step = dt;
+        if (stop_time > 0. && time + dt_step > stop_time) dt_step = stop_time - time;
+
+        m_dt[0] = dt_step;
+        for (int lev = 1; lev <= max_level; ++lev) {
+            m_dt[lev] = m_dt[lev-1] / m_nsubsteps[lev];
+        }
+
+        TimeStep(0, time);
+
+        time += dt_step;
+
+        Real step_stop_time = ParallelDescriptor::second() - step_strt_time;
+        ParallelDescriptor::ReduceRealMax(step_stop_time);
+
+        amrex::Print() << "Advanced step " << step << " on " << finest_level + 1 << " levels in "
+                       << step_stop_time << " seconds\n";
+
+        bool const last = (stop_time > 0. && time >= stop_time);
+
+        if (plot_int > 0 && (step%plot_int == 0 || last))
+        {
+            WritePlotFile(step);
+        }
+
+        if (diag_int > 0 && (step%diag_int == 0 || last))
+        {
+            WriteDiagnostics(diag_file, step, time, CurrentDiagnostics(time));
+        }
+
+        if (last) break;
+    }
+}
+
+void AmrMicroMag::TimeStep (int lev, Real time)
+{
+    // regrid the levels above lev every regrid_int steps of lev
+    if (m_regrid_int > 0 && lev < max_level
+        && m_istep[lev] > m_last_regrid_step[lev] && m_istep[lev] % m_regrid_int == 0)
+    {
+        int const old_finest = finest_level;
+
+        regrid(lev, time);
+
+        for (int k = lev; k <= finest_level; ++k) {
+            m_last_regrid_step[k] = m_istep[k];
+        }
+        for (int k = old_finest + 1; k <= finest_level; ++k) {
+            m_dt[k] = m_dt[k-1] / m_nsubsteps[k];
+        }
+
+        PrintGrids();
+    }
+
+    AdvanceLevel(lev, time, m_dt[lev]);
+    ++m_istep[lev];
+
+    if (lev < finest_level)
+    {
+        for (int i = 1; i <= m_nsubsteps[lev+1]; ++i)
+        {
+            TimeStep(lev+1, time + (i-1) * m_dt[lev+1]);
+        }
+
+        AverageDownTo(lev);
+    }
+}
+
+void AmrMicroMag::AdvanceLevel (int lev, Real time, Real dt_lev)
+{
+    BL_PROFILE("AmrMicroMag::AdvanceLevel()");
+
+    // the new solution becomes the old one; Advance overwrites every valid cell
+    std::swap(m_M_old[lev], m_M_new[lev]);
+    m_t_old[lev] = time;
+    m_t_new[lev] = time + dt_lev;
+
+    Array<MultiFab, AMREX_SPACEDIM> M = Components(m_M_new[lev]);
+    Array<MultiFab, AMREX_SPACEDIM> M_old = Components(m_M_old[lev]);
+
+    // level 0 computes demag at every stage and keeps the field of the first one, at
+    // time; a fine level takes that field of the coarser one for its whole step
+    Array<MultiFab, AMREX_SPACEDIM> H;
+    if (m_demag_coupling == 1)
+    {
+        if (lev == 0)
+        {
+            H = Components(m_H_stage);
+        }
+        else
+        {
+            H = Components(m_H[lev]);
+            AmrPhysBC cphysbc(Geom(lev-1), m_bcs, GpuBndryFuncFab<NoExtDirFill>(NoExtDirFill{}));
+            AmrPhysBC fphysbc(Geom(lev), m_bcs, GpuBndryFuncFab<NoExtDirFill>(NoExtDirFill{}));
+            amrex::InterpFromCoarseLevel(m_H[lev], time, m_H[lev-1], 0, 0, AMREX_SPACEDIM,
+                                         Geom(lev-1), Geom(lev), cphysbc, 0, fphysbc, 0,
+                                         refRatio(lev-1), &cell_cons_interp, m_bcs, 0);
+        }
+    }
+
+    if (m_thermal[lev].enabled()) m_thermal[lev].setStep(m_istep[lev] + 1, dt_lev);
+
+    auto EvaluateLLG = [&] (Array<MultiFab, AMREX_SPACEDIM>& M_stage,
+                            Array<MultiFab, AMREX_SPACEDIM>& dMdt, Real t)
+    {
+        FillGhostCells(lev, M_stage, t);
+
+        if (m_demag_coupling == 1 && lev == 0)
+        {
+            m_demag->ComputeHDemag(M_stage, H);
+
+            // the first stage is at time, from the state at the start of the step
+            if (t == time) MultiFab::Copy(m_H[0], m_H_stage, 0, 0, AMREX_SPACEDIM, 0);
+        }
+
+        m_llg_rhs(dMdt, M_stage, H, m_applied[lev], t, m_thermal[lev], *m_materials[lev], *m_stencil[lev],
+                  m_mu0, m_anisotropy_axis, Geom(lev), TileRegion::All);
+    };
+
+    Real dt_step = dt_lev;
+    m_integrator[lev]->Advance(M, M_old, EvaluateLLG, time, dt_step);
+
+    NormalizeM(M, *m_materials[lev], m_M_normalization);
+}
+
+void AmrMicroMag::FillPatch (int lev, Real time, MultiFab& mf)
+{
+    Vector<MultiFab*> fmf;
+    Vector<Real> ftime;
+    GetData(lev, time, fmf, ftime);
+
+    AmrPhysBC fphysbc(Geom(lev), m_bcs, GpuBndryFuncFab<NoExtDirFill>(NoExtDirFill{}));
+
+    if (lev == 0)
+    {
+        amrex::FillPatchSingleLevel(mf, time, fmf, ftime, 0, 0, AMREX_SPACEDIM, Geom(lev), fphysbc, 0);
+    }
+    else
+    {
+        Vector<MultiFab*> cmf;
+        Vector<Real> ctime;
+        GetData(lev-1, time, cmf, ctime);
+
+        AmrPhysBC cphysbc(Geom(lev-1), m_bcs, GpuBndryFuncFab<NoExtDirFill>(NoExtDirFill{}));
+
+        amrex::FillPatchTwoLevels(mf, time, cmf, ctime, fmf, ftime, 0, 0, AMREX_SPACEDIM,
+                                  Geom(lev-1), Geom(lev), cphysbc, 0, fphysbc, 0,
+                                  refRatio(lev-1), &cell_cons_interp, m_bcs, 0);
+    }
+}
+
+void AmrMicroMag::FillGhostCells (int lev, Array<MultiFab, AMREX_SPACEDIM>& M, Real t)
+{
+    BL_PROFILE("AmrMicroMag::FillGhostCells()");
+
+    if (lev == 0)
+    {
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            M[dir].FillBoundary(Geom(0).periodicity());
+        }
+    }
+    else
+    {
+        Vector<MultiFab*> cmf;
+        Vector<Real> ctime;
+        GetData(lev-1, t, cmf, ctime);
+
+        AmrPhysBC cphysbc(Geom(lev-1), m_bcs, GpuBndryFuncFab<NoExtDirFill>(NoExtDirFill{}));
+        AmrPhysBC fphysbc(Geom(lev), m_bcs, GpuBndryFuncFab<NoExtDirFill>(NoExtDirFill{}));
+
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            // component dir of the coarse states
+            Vector<MultiFab> c_comp;
+            for (MultiFab* c : cmf) c_comp.emplace_back(*c, amrex::make_alias, dir, 1);
+            Vector<MultiFab*> c_ptr;
+            for (MultiFab& c : c_comp) c_ptr.push_back(&c);
+
+            // the stage state is its own fine source, so its valid cells are kept and
+            // only the ghost cells are filled
+            Vector<MultiFab*> f_ptr = {&M[dir]};
+            amrex::FillPatchTwoLevels(M[dir], t, c_ptr, ctime, f_ptr, {t}, 0, 0, 1,
+                                      Geom(lev-1), Geom(lev), cphysbc, dir, fphysbc, dir,
+                                      refRatio(lev-1), &cell_cons_interp, m_bcs, dir);
+        }
+
+        // interpolation does not keep |M| = Ms; the valid cells are left to NormalizeM
+        ProjectToMs(lev, M, 1, &m_coarse_ghost[lev]);
+    }
+}
+
+void AmrMicroMag::ProjectToMs (int lev, Array<MultiFab, AMREX_SPACEDIM>& M, int nghost,
+                               const iMultiFab* cells)
+{
+    MaterialTable const mat = m_materials[lev]->table();
+    int const saturated = m_M_normalization;
+    bool const all_cells = (cells == nullptr);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+    for (MFIter mfi(M[0], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.growntilebox(nghost);
+
+        Array4<Real> const& Mx = M[0].array(mfi);
+        Array4<Real> const& My = M[1].array(mfi);
+        Array4<Real> const& Mz = M[2].array(mfi);
+        const Array4<int const>& id_arr = m_materials[lev]->id().const_array(mfi);
+        Array4<int const> cells_arr;
+        if (!all_cells) cells_arr = cells->const_array(mfi);
+
+        amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+        {
+            if (!all_cells && cells_arr(i,j,k) == 0) return;
+
+            int const m = id_arr(i,j,k);
+            if (m > 0)
+            {
+                Real const norm = std::sqrt(Mx(i,j,k)*Mx(i,j,k) + My(i,j,k)*My(i,j,k) + Mz(i,j,k)*Mz(i,j,k));
+                if (norm > 0.)
+                {
+                    if (saturated > 0 || norm > mat.Ms[m])
+                    {
+                        Real const s = mat.Ms[m] / norm;
+                        Mx(i,j,k) *= s;
+                        My(i,j,k) *= s;
+                        Mz(i,j,k) *= s;
+                    }
+                }
+                else if (saturated > 0)
+                {
+                    // a magnetic fine cell under a vacuum coarse cell has no direction yet
+                    Mx(i,j,k) = mat.Ms[m];
+                }
+            }
+            else
+            {
+                Mx(i,j,k) = 0.;
+                My(i,j,k) = 0.;
+                Mz(i,j,k) = 0.;
+            }
+        });
+    }
+}
+
+void AmrMicroMag::AverageDownTo (int crse_lev)
+{
+    amrex::average_down(m_M_new[crse_lev+1], m_M_new[crse_lev], 0, AMREX_SPACEDIM, refRatio(crse_lev));
+
+    Array<MultiFab, AMREX_SPACEDIM> M = Components(m_M_new[crse_lev]);
+    ProjectToMs(crse_lev, M, 0);
+}
+
+void AmrMicroMag::GetData (int lev, Real time, Vector<MultiFab*>& data, Vector<Real>& datatime)
+{
+    data.clear();
+    datatime.clear();
+
+    Real const teps = (m_t_new[lev] - m_t_old[lev]) * 1.e-3;
+
+    if (time > m_t_new[lev] - teps && time < m_t_new[lev] + teps)
+    {
+        data.push_back(&m_M_new[lev]);
+        datatime.push_back(m_t_new[lev]);
+    }
+    else if (time > m_t_old[lev] - teps && time < m_t_old[lev] + teps)
+    {
+        data.push_back(&m_M_old[lev]);
+        datatime.push_back(m_t_old[lev]);
+    }
+    else
+    {
+        data.push_back(&m_M_old[lev]);
+        data.push_back(&m_M_new[lev]);
+        datatime.push_back(m_t_old[lev]);
+        datatime.push_back(m_t_new[lev]);
+    }
+}
+
+void AmrMicroMag::DefineLevel (int lev, const BoxArray& ba, const DistributionMapping& dm)
+{
+    // ghost cells at non-periodic boundaries are never written, so they start from zero
+    m_M_new[lev] = MultiFab(ba, dm, AMREX_SPACEDIM, 1);
+    m_M_old[lev] = MultiFab(ba, dm, AMREX_SPACEDIM, 1);
+    m_M_new[lev].setVal(0.);
+    m_M_old[lev].setVal(0.);
+
+    // the ghost cells covered by neither a valid cell of this level nor the physical
+    // boundary are filled from the coarser level
+    m_coarse_ghost[lev] = iMultiFab(ba, dm, 1, 1);
+    if (lev == 0) {
+        m_coarse_ghost[lev].setVal(0);
+    } else {
+        m_coarse_ghost[lev].BuildMask(Geom(lev).Domain(), Geom(lev).periodicity(), 0, 1, 0, 0);
+    }
+
+    if (m_demag_coupling == 1)
+    {
+        m_H[lev] = MultiFab(ba, dm, AMREX_SPACEDIM, 0);
+        m_H[lev].setVal(0.);
+        if (lev == 0)
+        {
+            m_H_stage = MultiFab(ba, dm, AMREX_SPACEDIM, 0);
+            m_H_stage.setVal(0.);
+        }
+    }
+
+    // the material IDs, including their ghost cells, are painted at this level's resolution
+    m_materials[lev] = std::make_unique<Materials>(Geom(lev), ba, dm, 1, m_mu0);
+    m_stencil[lev] = std::make_unique<ExchangeStencil>(m_materials[lev]->id(), Geom(lev));
+    m_applied[lev] = AppliedField(Geom(lev));
+
+    // a key of its own per level, so no two levels draw the same noise for a cell index
+    m_thermal[lev] = ThermalField(*m_materials[lev], Geom(lev), m_mu0);
+    m_thermal[lev].seed += static_cast<std::uint64_t>(lev) * 0x9E3779B97F4A7C15ULL;
+
+    m_integrator[lev] = std::make_unique<TimeIntegrator>(m_order, ba, dm, 1);
+}
+
+void AmrMicroMag::MakeNewLevelFromScratch (int lev, Real time, const BoxArray& ba,
+                                           const DistributionMapping& dm)
+{
+    DefineLevel(lev, ba, dm);
+
+    m_t_new[lev] = time;
+    m_t_old[lev] = time - 1.e200;
+
+    Array<MultiFab, AMREX_SPACEDIM> M = Components(m_M_new[lev]);
+    InitializeM(M, *m_materials[lev], Geom(lev));
+}
+
+void AmrMicroMag::MakeNewLevelFromCoarse (int lev, Real time, const BoxArray& ba,
+                                          const DistributionMapping& dm)
+{
+    DefineLevel(lev, ba, dm);
+
+    m_t_new[lev] = time;
+    m_t_old[lev] = time - 1.e200;
+
+    // steps counted as if the level had always existed, so the thermal noise of a
+    // re-created level does not repeat steps drawn before
+    m_istep[lev] = m_istep[lev-1] * m_nsubsteps[lev];
+
+    AmrPhysBC cphysbc(Geom(lev-1), m_bcs, GpuBndryFuncFab<NoExtDirFill>(NoExtDirFill{}));
+    AmrPhysBC fphysbc(Geom(lev), m_bcs, GpuBndryFuncFab<NoExtDirFill>(NoExtDirFill{}));
+    amrex::InterpFromCoarseLevel(m_M_new[lev], time, m_M_new[lev-1], 0, 0, AMREX_SPACEDIM,
+                                 Geom(lev-1), Geom(lev), cphysbc, 0, fphysbc, 0,
+                                 refRatio(lev-1), &cell_cons_interp, m_bcs, 0);
+
+    Array<MultiFab, AMREX_SPACEDIM> M = Components(m_M_new[lev]);
+    ProjectToMs(lev, M, 0);
+}
+
+void AmrMicroMag::RemakeLevel (int lev, Real time, const BoxArray& ba,
+                               const DistributionMapping& dm)
+{
+    // the old grids of lev and the coarser level, before lev is redefined
+    MultiFab M_remade(ba, dm, AMREX_SPACEDIM, 1);
+    FillPatch(lev, time, M_remade);
+
+    DefineLevel(lev, ba, dm);
+    m_M_new[lev] = std::move(M_remade);
+
+    Array<MultiFab, AMREX_SPACEDIM> M = Components(m_M_new[lev]);
+    ProjectToMs(lev, M, 0);
+}
+
+void AmrMicroMag::ClearLevel (int lev)
+{
+    m_M_new[lev].clear();
+    m_M_old[lev].clear();
+    m_coarse_ghost[lev].clear();
+    m_H[lev].clear();
+    m_materials[lev].reset();
+    m_stencil[lev].reset();
+    m_integrator[lev].reset();
+}
+
+void AmrMicroMag::ErrorEst (int lev, TagBoxArray& tags, Real time, int /*ngrow*/)
+{
+    BL_PROFILE("AmrMicroMag::ErrorEst()");
+
+    MultiFab M_tag(grids[lev], dmap[lev], AMREX_SPACEDIM, 1);
+    FillPatch(lev, time, M_tag);
+    {
+        Array<MultiFab, AMREX_SPACEDIM> M = Components(M_tag);
+        ProjectToMs(lev, M, 1);
+    }
+
+    MaterialTable const mat = m_materials[lev]->table();
+    GpuArray<Real,AMREX_SPACEDIM> const dx = Geom(lev).CellSizeArray();
+    GpuArray<Real,AMREX_SPACEDIM> inv_dx2;
+    for (int idim = 0; idim < AMREX_SPACEDIM; ++idim) {
+        inv_dx2[idim] = 1. / (dx[idim] * dx[idim]);
+    }
+    Real const tag_grad_m = m_tag_grad_m;
+    Real const tag_exchange_energy = m_tag_exchange_energy;
+    char const tagval = TagBox::SET;
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+    for (MFIter mfi(M_tag, TilingIfNotGPU()); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.tilebox();
+
+        Array4<Real const> const& M = M_tag.const_array(mfi);
+        const Array4<int const>& id_arr = m_materials[lev]->id().const_array(mfi);
+        Array4<char> const& tag = tags.array(mfi);
+
+        amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+        {
+            int const m = id_arr(i,j,k);
+            if (m <= 0) return;
+
+            Real const inv_Ms = 1._rt / mat.Ms[m];
+
+            // largest change of m to a magnetic neighbor, and |grad m|^2 from the mean
+            // of the one-sided differences along each direction
+            Real dm_max = 0.;
+            Real grad2 = 0.;
+            for (int idim = 0; idim < AMREX_SPACEDIM; ++idim)
+            {
+                int const di = (idim == 0) ? 1 : 0;
+                int const dj = (idim == 1) ? 1 : 0;
+                int const dk = (idim == 2) ? 1 : 0;
+
+                Real sum = 0.;
+                int nside = 0;
+                for (int s = -1; s <= 1; s += 2)
+                {
+                    int const mn = id_arr(i+s*di,j+s*dj,k+s*dk);
+                    if (mn <= 0) continue;
+
+                    Real const inv_Ms_n = 1._rt / mat.Ms[mn];
+                    Real d2 = 0.;
+                    for (int n = 0; n < AMREX_SPACEDIM; ++n)
+                    {
+                        Real const d = M(i+s*di,j+s*dj,k+s*dk,n) * inv_Ms_n - M(i,j,k,n) * inv_Ms;
+                        d2 += d * d;
+                    }
+                    dm_max = amrex::max(dm_max, std::sqrt(d2));
+                    sum += d2;
+                    ++nside;
+                }
+                if (nside > 0) grad2 += sum / nside * inv_dx2[idim];
+            }
+
+            if ((tag_grad_m > 0. && dm_max > tag_grad_m)
+                || (tag_exchange_energy > 0. && mat.exchange[m] * grad2 > tag_exchange_energy))
+            {
+                tag(i,j,k) = tagval;
+            }
+        });
+    }
+}
+
+Real AmrMicroMag::StableDt (int lev) const
+{
+    MaterialTable const& mat = m_materials[0]->table();
+    GpuArray<Real,AMREX_SPACEDIM> const dx = Geom(lev).CellSizeArray();
+
+    Real dt_min = std::numeric_limits<Real>::max();
+    for (int m = 1; m <= m_materials[0]->numMaterials(); ++m)
+    {
+        Real const dt_m = ExchangeStableDt(m_order, mat.alpha[m], mat.gamma[m], mat.Ms[m], mat.exchange[m], dx);
+        if (dt_m <= 0.) return dt_m;
+        dt_min = amrex::min(dt_min, dt_m);
+    }
+    return dt_min;
+}
+
+void AmrMicroMag::PrintGrids () const
+{
+    for (int lev = 0; lev <= finest_level; ++lev)
+    {
+        amrex::Print() << " level " << lev << ": " << grids[lev].size() << " boxes, "
+                       << grids[lev].numPts() << " cells ("
+                       << 100. * static_cast<Real>(grids[lev].numPts()) / static_cast<Real>(Geom(lev).Domain().numPts())
+                       << "% of the level's domain)\n";
+    }
+}
+
+void AmrMicroMag::WritePlotFile (int step) const
+{
+    BL_PROFILE("AmrMicroMag::WritePlotFile()");
+
+    int const nlevels = finest_level + 1;
+
+    Vector<MultiFab> plt(nlevels);
+    for (int lev = 0; lev < nlevels; ++lev)
+    {
+        plt[lev].define(grids[lev], dmap[lev], AMREX_SPACEDIM + 1, 0);
+        MultiFab::Copy(plt[lev], m_M_new[lev], 0, 0, AMREX_SPACEDIM, 0);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+        for (MFIter mfi(plt[lev], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = mfi.tilebox();
+
+            Array4<Real> const& p = plt[lev].array(mfi);
+            const Array4<int const>& id_arr = m_materials[lev]->id().const_array(mfi);
+
+            amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+                p(i,j,k,AMREX_SPACEDIM) = static_cast<Real>(id_arr(i,j,k));
+            });
+        }
+    }
+
+    const std::string& pltfile = amrex::Concatenate("plt",step,8);
+    WriteMultiLevelPlotfile(pltfile, nlevels, amrex::GetVecOfConstPtrs(plt),
+                            {"Mx", "My", "Mz", "material"}, Geom(), m_t_new[0], m_istep, refRatio());
+}
+
+#endif
@@ -0,0 +1,159 @@
+#include "AppliedField.H"
+
+#include <AMReX_ParmParse.H>
+
+#include <cmath>
+#include <limits>
+
+AppliedField::AppliedField (const Geometry& geom)
+    : prob_lo(geom.ProbLoArray()), dx(geom.CellSizeArray())
+{
+    ParmParse pp;
+
+    Vector<Real> temp;
+
+    H_bias[1] = 3.7e4;
+    if (pp.queryarr("H_bias",temp)) {
+        for (int i=0; i<3; ++i) {
+            H_bias[i] = temp[i];
+        }
+    }
+
+    ParmParse pa("applied");
+
+    if (pa.queryarr("H",temp)) {
+        for (int i=0; i<3; ++i) {
+            H_applied[i] = temp[i];
+        }
+    }
+
+    std::string time = "constant";
+    pa.query("time", time);
+    pa.query("t0", t0);
+    if (time == "constant") {
+        time_profile = TimeProfile::Constant;
+    } else if (time == "pulse") {
+        time_profile = TimeProfile::Pulse;
+        pa.get("duration", duration);
+        pa.query("rise", rise);
+        if (duration < 0. || rise < 0.) amrex::Abort("applied.duration and applied.rise must be >= 0");
+    } else if (time == "sine") {
+        time_profile = TimeProfile::Sine;
+        pa.get("frequency", frequency);
+        pa.query("phase", phase);
+    } else if (time == "ramp") {
+        time_profile = TimeProfile::Ramp;
+        pa.get("ramp_time", ramp_time);
+        if (ramp_time <= 0.) amrex::Abort("applied.ramp_time must be > 0");
+    } else {
+        amrex::Abort("applied.time must be constant, pulse, sine or ramp");
+    }
+
+    std::string space = "uniform";
+    pa.query("space", space);
+    if (pa.queryarr("center",temp)) {
+        for (int i=0; i<3; ++i) {
+            center[i] = temp[i];
+        }
+    }
+    if (space == "uniform") {
+        space_profile = SpaceProfile::Uniform;
+    } else if (space == "gradient") {
+        space_profile = SpaceProfile::Gradient;
+        pa.getarr("gradient", temp, 0, 3);
+        for (int i=0; i<3; ++i) {
+            gradient[i] = temp[i];
+        }
+    } else if (space == "gaussian") {
+        space_profile = SpaceProfile::Gaussian;
+        pa.getarr("width", temp, 0, 3);
+        for (int i=0; i<3; ++i) {
+            inv_two_width2[i] = (temp[i] > 0.) ? 1. / (2. * temp[i] * temp[i]) : 0.;
+        }
+    } else {
+        amrex::Abort("applied.space must be uniform, gradient or gaussian");
+    }
+
+    // without a profiled part the kernels take the uniform, constant path
+    if (H_applied[0] == 0. && H_applied[1] == 0. && H_applied[2] == 0.) {
+        time_profile = TimeProfile::Constant;
+        space_profile = SpaceProfile::Uniform;
+    }
+}
+
+Real AppliedField::timeFactor (Real t) const
+{
+    switch (time_profile)
+    {
+    case TimeProfile::Pulse:
+    {
+        Real const s = t - t0;
+        if (rise <= 0.) return (s >= 0. && s < duration) ? 1. : 0.;
+        return amrex::max(0._rt, amrex::min(1._rt, amrex::min(s, 2. * rise + duration - s) / rise));
+    }
+    case TimeProfile::Sine:
+        return std::sin(2. * amrex::Math::pi<Real>() * frequency * (t - t0) + phase);
+    case TimeProfile::Ramp:
+        return amrex::max(0._rt, amrex::min(1._rt, (t - t0) / ramp_time));
+    default:
+        return 1.;
+    }
+}
+
+Real AppliedField::steadyAfter () const
+{
+    if (H_applied[0] == 0. && H_applied[1] == 0. && H_applied[2] == 0.) return 0.;
+
+    switch (time_profile)
+    {
+    case TimeProfile::Pulse:
+        return t0 + 2. * rise + duration;
+    case TimeProfile::Sine:
+        return std::numeric_limits<Real>::max();
+    case TimeProfile::Ramp:
+        return t0 + ramp_time;
+    default:
+        return 0.;
+    }
+}
+
+bool AppliedField::isConstant () const
+{
+    return steadyAfter() <= 0.;
+}
+
+void AppliedField::fill (MultiFab& mf, int comp, int dir, Real t) const
+{
+    AppliedField const applied = *this;
+    Real const f = timeFactor(t);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+    for (MFIter mfi(mf, TilingIfNotGPU()); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.tilebox();
+
+        const Array4<Real>& H = mf.array(mfi, comp);
+
+        amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+        {
+            Real Hx, Hy, Hz;
+            applied.eval(i, j, k, f, Hx, Hy, Hz);
+            H(i,j,k) = (dir == 0) ? Hx : ((dir == 1) ? Hy : Hz);
+        });
+    }
+}
+
+void AppliedField::print () const
+{
+    static const char* time_names[] = {"constant", "pulse", "sine", "ramp"};
+    static const char* space_names[] = {"uniform", "gradient", "gaussian"};
+
+    amrex::Print() << " H_bias              = " << H_bias[0] << " " << H_bias[1] << " " << H_bias[2] << "\n";
+    if (H_applied[0] != 0. || H_applied[1] != 0. || H_applied[2] != 0.) {
+        amrex::Print() << " applied.H           = " << H_applied[0] << " " << H_applied[1] << " " << H_applied[2]
+                       << " (" << time_names[static_cast<int>(time_profile)] << " in time, "
+                       << space_names[static_cast<int>(space_profile)] << " in space)\n";
+    }
+}
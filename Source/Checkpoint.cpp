@@ -0,0 +1,135 @@
+#include "Checkpoint.H"
+
+#include <AMReX_VisMF.H>
+#include <AMReX_PlotFileUtil.H>
+#include <AMReX_Utility.H>
+
+#include <fstream>
+#include <sstream>
+
+// skip the rest of the current line of a header
+static void GotoNextLine (std::istream& is)
+{
+    constexpr std::streamsize bl_ignore_max { 100000 };
+    is.ignore(bl_ignore_max, '\n');
+}
+
+void WriteCheckpoint(const std::string&                        chkfile,
+                     int                                       step,
+                     Real                                      time,
+                     Real                                      dt,
+                     Real                                      dM_rel,
+                     const Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                     const MultiFab*                           PoissonPhi,
+                     int                                       nfiles)
+{
+    BL_PROFILE("WriteCheckpoint()");
+
+    amrex::Print() << "Writing checkpoint " << chkfile << "\n";
+
+    amrex::PreBuildDirectorHierarchy(chkfile, "Level_", 1, true);
+
+    VisMF::IO_Buffer io_buffer(VisMF::IO_Buffer_Size);
+
+    if (ParallelDescriptor::IOProcessor())
+    {
+        std::string HeaderFileName(chkfile + "/Header");
+        std::ofstream HeaderFile;
+        HeaderFile.rdbuf()->pubsetbuf(io_buffer.dataPtr(), io_buffer.size());
+        HeaderFile.open(HeaderFileName.c_str(), std::ofstream::out |
+                                                std::ofstream::trunc |
+                                                std::ofstream::binary);
+        if (!HeaderFile.good()) {
+            amrex::FileOpenFailed(HeaderFileName);
+        }
+
+        HeaderFile.precision(17);
+
+        HeaderFile << "Checkpoint file for MicroMag\n";
+        HeaderFile << step << "\n";
+        HeaderFile << time << "\n";
+        HeaderFile << dt << "\n";
+        HeaderFile << dM_rel << "\n";
+        HeaderFile << (PoissonPhi ? 1 : 0) << "\n";
+    }
+
+    // valid cells of the three components in one MultiFab
+    MultiFab M(Mfield[0].boxArray(), Mfield[0].DistributionMap(), AMREX_SPACEDIM, 0);
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        ConvertCopy(M, Mfield[dir], 0, dir, 1, 0);
+    }
+
+    int const nfiles_default = VisMF::GetNOutFiles();
+    VisMF::SetNOutFiles(nfiles);
+
+    VisMF::Write(M, amrex::MultiFabFileFullPrefix(0, chkfile, "Level_", "M"));
+    if (PoissonPhi)
+    {
+        MultiFab Phi(PoissonPhi->boxArray(), PoissonPhi->DistributionMap(), 1, 0);
+        MultiFab::Copy(Phi, *PoissonPhi, 0, 0, 1, 0);
+        VisMF::Write(Phi, amrex::MultiFabFileFullPrefix(0, chkfile, "Level_", "Phi"));
+    }
+
+    VisMF::SetNOutFiles(nfiles_default);
+}
+
+bool ReadCheckpoint(const std::string&                  chkfile,
+                    int&                                step,
+                    Real&                               time,
+                    Real&                               dt,
+                    Real&                               dM_rel,
+                    Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                    MultiFab*                           PoissonPhi,
+                    const Geometry&                     geom)
+{
+    BL_PROFILE("ReadCheckpoint()");
+
+    amrex::Print() << "Restarting from checkpoint " << chkfile << "\n";
+
+    std::string File(chkfile + "/Header");
+
+    Vector<char> fileCharPtr;
+    ParallelDescriptor::ReadAndBcastFile(File, fileCharPtr);
+    std::string fileCharPtrString(fileCharPtr.dataPtr());
+    std::istringstream is(fileCharPtrString, std::istringstream::in);
+
+    std::string line;
+    int has_phi;
+
+    // title line
+    std::getline(is, line);
+
+    is >> step;
+    GotoNextLine(is);
+    is >> time;
+    GotoNextLine(is);
+    is >> dt;
+    GotoNextLine(is);
+    is >> dM_rel;
+    GotoNextLine(is);
+    is >> has_phi;
+    GotoNextLine(is);
+
+    // the file carries its own BoxArray and is always double; copy onto the layout
+    // of this run, then into the storage type of M
+    MultiFab M;
+    VisMF::Read(M, amrex::MultiFabFileFullPrefix(0, chkfile, "Level_", "M"));
+    MultiFab M_comp(Mfield[0].boxArray(), Mfield[0].DistributionMap(), 1, 0);
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        Mfield[dir].setVal(0.);
+        M_comp.setVal(0.);
+        M_comp.ParallelCopy(M, dir, 0, 1, 0, 0, geom.periodicity());
+        ConvertCopy(Mfield[dir], M_comp, 0, 0, 1, 0);
+    }
+
+    if (has_phi == 1 && PoissonPhi)
+    {
+        MultiFab Phi;
+        VisMF::Read(Phi, amrex::MultiFabFileFullPrefix(0, chkfile, "Level_", "Phi"));
+        PoissonPhi->ParallelCopy(Phi, 0, 0, 1);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,315 @@
+#include "Demagnetization.H"
+#include "DemagTensor.H"
+
+#include <AMReX_ParallelDescriptor.H>
+
+#include <limits>
+
+Demagnetization::Demagnetization (const Geometry& geom, int max_grid_size)
+{
+    const Box& domain = geom.Domain();
+    const IntVect n = domain.length();
+
+    // padded domain, twice the size of the physical domain in each direction
+    Box domain_large(IntVect(AMREX_D_DECL(0, 0, 0)),
+                     IntVect(AMREX_D_DECL(2*n[0]-1, 2*n[1]-1, 2*n[2]-1)));
+
+    BoxArray ba_large(domain_large);
+    ba_large.maxSize(max_grid_size);
+    DistributionMapping dm_large(ba_large);
+
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        m_M_large[dir].define(ba_large, dm_large, 1, 0);
+    }
+
+    m_fft = std::make_unique<FFT::R2C<Real, FFT::Direction::both> >(domain_large);
+
+    auto const& [cba, cdm] = m_fft->getSpectralDataLayout();
+    for (int comp = 0; comp < 6; comp++)
+    {
+        m_N_fft[comp].define(cba, cdm, 1, 0);
+    }
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        m_M_fft[dir].define(cba, cdm, 1, 0);
+    }
+
+    // tensor is evaluated in units of dx[0]
+    GpuArray<Real,AMREX_SPACEDIM> dx = geom.CellSizeArray();
+    Real const hx = 1.;
+    Real const hy = dx[1] / dx[0];
+    Real const hz = dx[2] / dx[0];
+    Real const rfar = far_radius;
+
+    // store -N so that the spectral product gives H directly, and fold in the
+    // 1/N normalization of the unnormalized backward transform
+    Real const scale = -1. / domain_large.d_numPts();
+
+    int const nx = n[0];
+    int const ny = n[1];
+    int const nz = n[2];
+
+    MultiFab& N_real = m_M_large[0];
+
+    for (int comp = 0; comp < 6; comp++)
+    {
+        for (MFIter mfi(N_real); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = mfi.validbox();
+
+            const Array4<Real>& N_arr = N_real.array(mfi);
+
+            amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+                // separations wrap around the padded domain
+                int const ii = (i < nx) ? i : i - 2*nx;
+                int const jj = (j < ny) ? j : j - 2*ny;
+                int const kk = (k < nz) ? k : k - 2*nz;
+
+                N_arr(i,j,k) = scale * DemagTensor(comp, ii*hx, jj*hy, kk*hz, hx, hy, hz, rfar);
+            });
+        }
+
+        m_fft->forward(N_real, m_N_fft[comp]);
+    }
+}
+
+void Demagnetization::ComputeHDemag (const Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                                     Array<MagMultiFab, AMREX_SPACEDIM>& Hfield)
+{
+    BL_PROFILE("Demagnetization::ComputeHDemag()");
+
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        m_M_large[dir].setVal(0.);
+        m_M_large[dir].ParallelCopy(RealView(Mfield[dir], m_M_real), 0, 0, 1);
+        m_fft->forward(m_M_large[dir], m_M_fft[dir]);
+    }
+
+    // H_hat = -N_hat * M_hat, overwriting M_hat in place
+    for (MFIter mfi(m_M_fft[0]); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.validbox();
+
+        Array4<GpuComplex<Real> > const& Mx = m_M_fft[0].array(mfi);
+        Array4<GpuComplex<Real> > const& My = m_M_fft[1].array(mfi);
+        Array4<GpuComplex<Real> > const& Mz = m_M_fft[2].array(mfi);
+
+        Array4<GpuComplex<Real> const> const& Nxx = m_N_fft[0].const_array(mfi);
+        Array4<GpuComplex<Real> const> const& Nxy = m_N_fft[1].const_array(mfi);
+        Array4<GpuComplex<Real> const> const& Nxz = m_N_fft[2].const_array(mfi);
+        Array4<GpuComplex<Real> const> const& Nyy = m_N_fft[3].const_array(mfi);
+        Array4<GpuComplex<Real> const> const& Nyz = m_N_fft[4].const_array(mfi);
+        Array4<GpuComplex<Real> const> const& Nzz = m_N_fft[5].const_array(mfi);
+
+        amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+        {
+            GpuComplex<Real> const mx = Mx(i,j,k);
+            GpuComplex<Real> const my = My(i,j,k);
+            GpuComplex<Real> const mz = Mz(i,j,k);
+
+            Mx(i,j,k) = Nxx(i,j,k) * mx + Nxy(i,j,k) * my + Nxz(i,j,k) * mz;
+            My(i,j,k) = Nxy(i,j,k) * mx + Nyy(i,j,k) * my + Nyz(i,j,k) * mz;
+            Mz(i,j,k) = Nxz(i,j,k) * mx + Nyz(i,j,k) * my + Nzz(i,j,k) * mz;
+        });
+    }
+
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        m_fft->backward(m_M_fft[dir], m_M_large[dir]);
+        ParallelCopyToMag(Hfield[dir], m_M_large[dir], 0, 0, m_H_real);
+    }
+}
+
+void Demagnetization::ComputeHDemagDirect (const Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                                           Array<MagMultiFab, AMREX_SPACEDIM>& Hfield,
+                                           const iMultiFab& material_id,
+                                           const Geometry& geom)
+{
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        Hfield[dir].setVal(0.);
+    }
+
+    // index bounding box of the magnetic region
+    ReduceOps<ReduceOpMin, ReduceOpMin, ReduceOpMin, ReduceOpMax, ReduceOpMax, ReduceOpMax> reduce_op;
+    ReduceData<int, int, int, int, int, int> reduce_data(reduce_op);
+    using ReduceTuple = typename decltype(reduce_data)::Type;
+
+    int const imax = std::numeric_limits<int>::max();
+    int const imin = std::numeric_limits<int>::lowest();
+
+    for (MFIter mfi(material_id); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.validbox();
+
+        const Array4<int const>& id_arr = material_id.const_array(mfi);
+
+        reduce_op.eval(bx, reduce_data, [=] AMREX_GPU_DEVICE (int i, int j, int k) -> ReduceTuple
+        {
+            if (id_arr(i,j,k) > 0) return {i, j, k, i, j, k};
+            return {imax, imax, imax, imin, imin, imin};
+        });
+    }
+
+    ReduceTuple hv = reduce_data.value(reduce_op);
+    int lo[3] = {amrex::get<0>(hv), amrex::get<1>(hv), amrex::get<2>(hv)};
+    int hi[3] = {amrex::get<3>(hv), amrex::get<4>(hv), amrex::get<5>(hv)};
+    for (int dir = 0; dir < 3; dir++)
+    {
+        ParallelDescriptor::ReduceIntMin(lo[dir]);
+        ParallelDescriptor::ReduceIntMax(hi[dir]);
+    }
+
+    if (lo[0] > hi[0]) return; // no magnetic cells
+
+    Box mag_box(IntVect(AMREX_D_DECL(lo[0], lo[1], lo[2])),
+                IntVect(AMREX_D_DECL(hi[0], hi[1], hi[2])));
+
+    // every rank gets a copy of M over the magnetic region
+    FArrayBox M_fab(mag_box, 3);
+    M_fab.setVal<RunOn::Device>(0.);
+    MultiFab M_real;
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        RealView(Mfield[dir], M_real).copyTo(M_fab, 0, dir, 1);
+    }
+
+    // real-space tensor for every separation within the magnetic region
+    const IntVect len = mag_box.length();
+    Box offset_box(IntVect(AMREX_D_DECL(1-len[0], 1-len[1], 1-len[2])),
+                   IntVect(AMREX_D_DECL(len[0]-1, len[1]-1, len[2]-1)));
+    FArrayBox N_fab(offset_box, 6);
+
+    GpuArray<Real,AMREX_SPACEDIM> dx = geom.CellSizeArray();
+    Real const hx = 1.;
+    Real const hy = dx[1] / dx[0];
+    Real const hz = dx[2] / dx[0];
+    Real const rfar = far_radius;
+
+    Array4<Real> const& N_arr = N_fab.array();
+    amrex::ParallelFor( offset_box, 6, [=] AMREX_GPU_DEVICE (int i, int j, int k, int comp)
+    {
+        N_arr(i,j,k,comp) = - DemagTensor(comp, i*hx, j*hy, k*hz, hx, hy, hz, rfar);
+    });
+
+    Array4<Real const> const& M_arr = M_fab.const_array();
+    Array4<Real const> const& N = N_fab.const_array();
+    const Dim3 mlo = amrex::lbound(mag_box);
+    const Dim3 mhi = amrex::ubound(mag_box);
+
+    for (MFIter mfi(Hfield[0]); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.validbox() & mag_box;
+        if (!bx.ok()) continue;
+
+        Array4<MagReal> const& Hx = Hfield[0].array(mfi);
+        Array4<MagReal> const& Hy = Hfield[1].array(mfi);
+        Array4<MagReal> const& Hz = Hfield[2].array(mfi);
+
+        amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+        {
+            Real hx_sum = 0., hy_sum = 0., hz_sum = 0.;
+            for (int kk = mlo.z; kk <= mhi.z; ++kk) {
+            for (int jj = mlo.y; jj <= mhi.y; ++jj) {
+            for (int ii = mlo.x; ii <= mhi.x; ++ii) {
+                Real const mx = M_arr(ii,jj,kk,0);
+                Real const my = M_arr(ii,jj,kk,1);
+                Real const mz = M_arr(ii,jj,kk,2);
+                int const oi = i - ii;
+                int const oj = j - jj;
+                int const ok = k - kk;
+                hx_sum += N(oi,oj,ok,0) * mx + N(oi,oj,ok,1) * my + N(oi,oj,ok,2) * mz;
+                hy_sum += N(oi,oj,ok,1) * mx + N(oi,oj,ok,3) * my + N(oi,oj,ok,4) * mz;
+                hz_sum += N(oi,oj,ok,2) * mx + N(oi,oj,ok,4) * my + N(oi,oj,ok,5) * mz;
+            }
+            }
+            }
+            Hx(i,j,k) = static_cast<MagReal>(hx_sum);
+            Hy(i,j,k) = static_cast<MagReal>(hy_sum);
+            Hz(i,j,k) = static_cast<MagReal>(hz_sum);
+        });
+    }
+    Gpu::streamSynchronize();
+}
+
+void DemagBenchmark (Demagnetization& demag,
+                     const Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                     const iMultiFab& material_id,
+                     const Geometry& geom)
+{
+    const BoxArray& ba = Mfield[0].boxArray();
+    const DistributionMapping& dm = Mfield[0].DistributionMap();
+
+    Array<MagMultiFab, AMREX_SPACEDIM> H_fft;
+    Array<MagMultiFab, AMREX_SPACEDIM> H_direct;
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        H_fft[dir].define(ba, dm, 1, 0);
+        H_direct[dir].define(ba, dm, 1, 0);
+    }
+
+    int const nrepeat = 10;
+
+    Real fft_time = ParallelDescriptor::second();
+    for (int n = 0; n < nrepeat; n++)
+    {
+        demag.ComputeHDemag(Mfield, H_fft);
+    }
+    Gpu::streamSynchronize();
+    fft_time = (ParallelDescriptor::second() - fft_time) / nrepeat;
+    ParallelDescriptor::ReduceRealMax(fft_time);
+
+    Real direct_time = ParallelDescriptor::second();
+    Demagnetization::ComputeHDemagDirect(Mfield, H_direct, material_id, geom);
+    direct_time = ParallelDescriptor::second() - direct_time;
+    ParallelDescriptor::ReduceRealMax(direct_time);
+
+    // compare inside the magnetic region, where the LLG update uses H
+    ReduceOps<ReduceOpMax, ReduceOpMax, ReduceOpSum> reduce_op;
+    ReduceData<Real, Real, Long> reduce_data(reduce_op);
+    using ReduceTuple = typename decltype(reduce_data)::Type;
+
+    for (MFIter mfi(material_id); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.validbox();
+
+        const Array4<int const>& id_arr = material_id.const_array(mfi);
+        const Array4<MagReal const>& Hx_f = H_fft[0].const_array(mfi);
+        const Array4<MagReal const>& Hy_f = H_fft[1].const_array(mfi);
+        const Array4<MagReal const>& Hz_f = H_fft[2].const_array(mfi);
+        const Array4<MagReal const>& Hx_d = H_direct[0].const_array(mfi);
+        const Array4<MagReal const>& Hy_d = H_direct[1].const_array(mfi);
+        const Array4<MagReal const>& Hz_d = H_direct[2].const_array(mfi);
+
+        reduce_op.eval(bx, reduce_data, [=] AMREX_GPU_DEVICE (int i, int j, int k) -> ReduceTuple
+        {
+            if (id_arr(i,j,k) == 0) return {0._rt, 0._rt, 0};
+            Real const err = amrex::max(amrex::Math::abs(Real(Hx_f(i,j,k)) - Real(Hx_d(i,j,k))),
+                                        amrex::Math::abs(Real(Hy_f(i,j,k)) - Real(Hy_d(i,j,k))),
+                                        amrex::Math::abs(Real(Hz_f(i,j,k)) - Real(Hz_d(i,j,k))));
+            Real const mag = amrex::max(amrex::Math::abs(Real(Hx_d(i,j,k))),
+                                        amrex::Math::abs(Real(Hy_d(i,j,k))),
+                                        amrex::Math::abs(Real(Hz_d(i,j,k))));
+            return {err, mag, 1};
+        });
+    }
+
+    ReduceTuple hv = reduce_data.value(reduce_op);
+    Real max_err = amrex::get<0>(hv);
+    Real max_H = amrex::get<1>(hv);
+    Long ncells = amrex::get<2>(hv);
+    ParallelDescriptor::ReduceRealMax(max_err);
+    ParallelDescriptor::ReduceRealMax(max_H);
+    ParallelDescriptor::ReduceLongSum(ncells);
+
+    amrex::Print() << "==================== Demag Benchmark ====================\n";
+    amrex::Print() << " domain cells                = " << geom.Domain().numPts() << "\n";
+    amrex::Print() << " magnetic cells              = " << ncells << "\n";
+    amrex::Print() << " FFT convolution (per call)  = " << fft_time << " seconds\n";
+    amrex::Print() << " direct summation            = " << direct_time << " seconds\n";
+    amrex::Print() << " speedup                     = " << direct_time / fft_time << "\n";
+    amrex::Print() << " max |H_fft - H_direct|/|H|  = " << ((max_H > 0.) ? max_err / max_H : 0.) << "\n";
+    amrex::Print() << "=========================================================\n";
+}
@@ -0,0 +1,181 @@
+#include "Diagnostics.H"
+#include "MagLaplacian.H"
+
+#include <fstream>
+#include <sstream>
+
+MagneticDiagnostics ComputeDiagnostics(Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                                       Array<MagMultiFab, AMREX_SPACEDIM>& Hfield,
+                                       const AppliedField&                 applied,
+                                       Real                                time,
+                                       const Materials&                    materials,
+                                       const ExchangeStencil&              stencil,
+                                       int                                 demag_coupling,
+                                       int                                 exchange_coupling,
+                                       int                                 anisotropy_coupling,
+                                       Real                                mu0,
+                                       amrex::GpuArray<amrex::Real, 3>     anisotropy_axis,
+                                       const Geometry&                     geom)
+{
+    BL_PROFILE("ComputeDiagnostics()");
+
+    GpuArray<Real,AMREX_SPACEDIM> dx = geom.CellSizeArray();
+    Real const dV = dx[0] * dx[1] * dx[2];
+
+    Real const f = applied.timeFactor(time);
+
+    // sums of Mx, My, Mz, the four energy densities and the magnetic cell count;
+    // max of the torque
+    ReduceOps<ReduceOpSum, ReduceOpSum, ReduceOpSum, ReduceOpSum, ReduceOpSum, ReduceOpSum,
+              ReduceOpSum, ReduceOpSum, ReduceOpMax> reduce_op;
+    ReduceData<Real, Real, Real, Real, Real, Real, Real, Real, Real> reduce_data(reduce_op);
+    using ReduceTuple = typename decltype(reduce_data)::Type;
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+    for (MFIter mfi(Mfield[0], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.tilebox();
+
+        Array4<MagReal> Hx, Hy, Hz;
+        if (demag_coupling == 1) {
+            Hx = Hfield[0].array(mfi);
+            Hy = Hfield[1].array(mfi);
+            Hz = Hfield[2].array(mfi);
+        }
+        Array4<MagReal> const &Mx = Mfield[0].array(mfi);
+        Array4<MagReal> const &My = Mfield[1].array(mfi);
+        Array4<MagReal> const &Mz = Mfield[2].array(mfi);
+
+        const Array4<int const>& id_arr = materials.id().const_array(mfi);
+        MaterialTable const mat = materials.table();
+        const Array4<int const>& mask_arr = stencil.mask().const_array(mfi);
+        GpuArray<Real,AMREX_SPACEDIM> const inv_dx2 = stencil.invDx2();
+
+        reduce_op.eval(bx, reduce_data, [=] AMREX_GPU_DEVICE (int i, int j, int k) -> ReduceTuple
+        {
+            int const m = id_arr(i,j,k);
+            if (m == 0) return {0., 0., 0., 0., 0., 0., 0., 0., 0.};
+
+            Real const mx = Mx(i,j,k);
+            Real const my = My(i,j,k);
+            Real const mz = Mz(i,j,k);
+
+            Real Hx_eff, Hy_eff, Hz_eff;
+            applied.eval(i, j, k, f, Hx_eff, Hy_eff, Hz_eff);
+            Real const e_zeeman = - mu0 * (mx * Hx_eff + my * Hy_eff + mz * Hz_eff);
+
+            Real e_demag = 0.;
+            if (demag_coupling == 1)
+            {
+                Hx_eff += Hx(i,j,k);
+                Hy_eff += Hy(i,j,k);
+                Hz_eff += Hz(i,j,k);
+                e_demag = - 0.5 * mu0 * (mx * Hx(i,j,k) + my * Hy(i,j,k) + mz * Hz(i,j,k));
+            }
+
+            Real e_exchange = 0.;
+            if (exchange_coupling == 1)
+            {
+                Real H_ex_x, H_ex_y, H_ex_z;
+                ExchangeField_Mag(Mx, My, Mz, id_arr, mat, m, mask_arr(i,j,k), inv_dx2, i, j, k, H_ex_x, H_ex_y, H_ex_z);
+                Hx_eff += H_ex_x;
+                Hy_eff += H_ex_y;
+                Hz_eff += H_ex_z;
+                e_exchange = - 0.5 * mu0 * (mx * H_ex_x + my * H_ex_y + mz * H_ex_z);
+            }
+
+            Real e_anisotropy = 0.;
+            if (anisotropy_coupling == 1)
+            {
+                Real const M_dot_anisotropy_axis = mx * anisotropy_axis[0] + my * anisotropy_axis[1] + mz * anisotropy_axis[2];
+                Real const H_anisotropy_coeff = mat.anisotropy_coeff[m];
+                Hx_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[0];
+                Hy_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[1];
+                Hz_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[2];
+                e_anisotropy = - 0.5 * mu0 * H_anisotropy_coeff * M_dot_anisotropy_axis * M_dot_anisotropy_axis;
+            }
+
+            Real const tx = my * Hz_eff - mz * Hy_eff;
+            Real const ty = mz * Hx_eff - mx * Hz_eff;
+            Real const tz = mx * Hy_eff - my * Hx_eff;
+            Real const torque = std::sqrt(tx*tx + ty*ty + tz*tz) / mat.Ms[m];
+
+            return {mx, my, mz, e_exchange, e_anisotropy, e_zeeman, e_demag, 1., torque};
+        });
+    }
+
+    ReduceTuple hv = reduce_data.value(reduce_op);
+
+    Real sums[8] = {amrex::get<0>(hv), amrex::get<1>(hv), amrex::get<2>(hv), amrex::get<3>(hv),
+                    amrex::get<4>(hv), amrex::get<5>(hv), amrex::get<6>(hv), amrex::get<7>(hv)};
+    Real max_torque = amrex::get<8>(hv);
+    ParallelDescriptor::ReduceRealSum(sums, 8);
+    ParallelDescriptor::ReduceRealMax(max_torque);
+
+    MagneticDiagnostics diag;
+    Real const ncells = amrex::max(sums[7], 1.);
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++) {
+        diag.M_avg[dir] = sums[dir] / ncells;
+    }
+    diag.E_exchange = sums[3] * dV;
+    diag.E_anisotropy = sums[4] * dV;
+    diag.E_zeeman = sums[5] * dV;
+    diag.E_demag = sums[6] * dV;
+    diag.max_torque = max_torque;
+    return diag;
+}
+
+void InitDiagnosticsFile(const std::string& diag_file, bool append)
+{
+    if (!ParallelDescriptor::IOProcessor() || append) return;
+
+    std::ofstream ofs(diag_file, std::ofstream::out | std::ofstream::trunc);
+    if (!ofs.good()) amrex::FileOpenFailed(diag_file);
+    ofs << "step,time,Mx_avg,My_avg,Mz_avg,E_exchange,E_anisotropy,E_zeeman,E_demag,E_total,max_torque\n";
+}
+
+void WriteDiagnostics(const std::string& diag_file, int step, Real time,
+                      const MagneticDiagnostics& diag)
+{
+    if (!ParallelDescriptor::IOProcessor()) return;
+
+    std::ofstream ofs(diag_file, std::ofstream::out | std::ofstream::app);
+    if (!ofs.good()) amrex::FileOpenFailed(diag_file);
+    ofs.precision(12);
+    ofs << step << "," << time << ","
+        << diag.M_avg[0] << "," << diag.M_avg[1] << "," << diag.M_avg[2] << ","
+        << diag.E_exchange << "," << diag.E_anisotropy << "," << diag.E_zeeman << ","
+        << diag.E_demag << "," << diag.totalEnergy() << "," << diag.max_torque << "\n";
+}
+
+ConvergenceMonitor::ConvergenceMonitor (Real dMdt_tol, Real torque_tol, Real energy_tol, Real Ms_val)
+    : m_dMdt_tol(dMdt_tol), m_torque_tol(torque_tol), m_energy_tol(energy_tol), m_Ms_val(Ms_val)
+{}
+
+bool ConvergenceMonitor::check (Real dMdt_max, const MagneticDiagnostics& diag)
+{
+    std::ostringstream reason;
+
+    Real const dMdt_rel = dMdt_max / m_Ms_val;
+    Real const torque_rel = diag.max_torque / m_Ms_val;
+    Real const E = diag.totalEnergy();
+
+    if (m_dMdt_tol > 0. && dMdt_rel < m_dMdt_tol) {
+        reason << "max |dM/dt|/Ms = " << dMdt_rel << " < " << m_dMdt_tol;
+    } else if (m_torque_tol > 0. && torque_rel < m_torque_tol) {
+        reason << "max |M x H_eff|/Ms^2 = " << torque_rel << " < " << m_torque_tol;
+    } else if (m_energy_tol > 0. && m_have_prev && E != 0.) {
+        Real const dE_rel = amrex::Math::abs(E - m_E_prev) / amrex::Math::abs(E);
+        if (dE_rel < m_energy_tol) {
+            reason << "relative energy change " << dE_rel << " < " << m_energy_tol;
+        }
+    }
+
+    m_E_prev = E;
+    m_have_prev = true;
+
+    m_reason = reason.str();
+    return !m_reason.empty();
+}
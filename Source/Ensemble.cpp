@@ -0,0 +1,111 @@
+#include "Ensemble.H"
+
+#include <AMReX_ParmParse.H>
+#include <AMReX_Utility.H>
+
+#include <iostream>
+
+#include <unistd.h>
+
+Ensemble::Ensemble ()
+    : m_nranks(ParallelDescriptor::NProcs()), m_rank(ParallelDescriptor::MyProc())
+{
+    ParmParse pe("ensemble");
+
+    pe.query("members", m_nmembers);
+    if (m_nmembers <= 1) {
+        m_nmembers = 1;
+        return;
+    }
+
+    pe.query("dir", m_dir);
+
+    pe.queryarr("vary", m_keys);
+    for (auto const& key : m_keys)
+    {
+        std::vector<std::string> all;
+        pe.getarr(key.c_str(), all);
+        if (all.size() % m_nmembers != 0) {
+            amrex::Abort("ensemble." + key + " must hold the same number of values for each of the "
+                         + std::to_string(m_nmembers) + " members");
+        }
+        std::size_t const ncomp = all.size() / m_nmembers;
+
+        std::vector<std::vector<std::string> > per_member(m_nmembers);
+        for (int m = 0; m < m_nmembers; ++m) {
+            per_member[m].assign(all.begin() + m * ncomp, all.begin() + (m + 1) * ncomp);
+        }
+        m_values.push_back(per_member);
+    }
+
+    // equal groups of ranks; a group with fewer ranks than members runs several
+    m_ngroups = amrex::min(m_nmembers, m_nranks);
+    if (m_nranks % m_ngroups != 0) {
+        amrex::Abort("ensemble: " + std::to_string(m_nranks) + " ranks cannot be split into "
+                     + std::to_string(m_ngroups) + " equal groups");
+    }
+    int const group = m_rank / (m_nranks / m_ngroups);
+    for (int m = group; m < m_nmembers; m += m_ngroups) {
+        m_my_members.push_back(m);
+    }
+
+#ifdef AMREX_USE_MPI
+    MPI_Comm_split(MPI_COMM_WORLD, group, m_rank, &m_comm);
+#endif
+
+    char cwd[4096];
+    if (::getcwd(cwd, sizeof(cwd)) == nullptr) {
+        amrex::Abort("ensemble: cannot get the working directory");
+    }
+    m_start_dir = cwd;
+
+    amrex::Print() << "Ensemble of " << m_nmembers << " members in " << m_ngroups << " groups of "
+                   << m_nranks / m_ngroups << " ranks\n";
+}
+
+void Ensemble::begin (int member)
+{
+    ParmParse pp;
+    for (std::size_t k = 0; k < m_keys.size(); ++k) {
+        pp.addarr(m_keys[k].c_str(), m_values[k][member]);
+    }
+
+    std::string const dir = amrex::Concatenate(m_dir, member, 4);
+    if (ParallelDescriptor::IOProcessor()) {
+        if (!amrex::UtilCreateDirectory(dir, 0755)) amrex::CreateDirectoryFailed(dir);
+    }
+    ParallelDescriptor::Barrier();
+    if (::chdir(dir.c_str()) != 0) {
+        amrex::Abort("ensemble: cannot enter " + dir);
+    }
+
+    amrex::Print() << "==================== Ensemble member " << member << " of " << m_nmembers
+                   << " ====================\n";
+    amrex::Print() << " output directory    = " << dir << "\n";
+    for (std::size_t k = 0; k < m_keys.size(); ++k)
+    {
+        amrex::Print() << " " << m_keys[k] << " =";
+        for (auto const& v : m_values[k][member]) amrex::Print() << " " << v;
+        amrex::Print() << "\n";
+    }
+}
+
+void Ensemble::end ()
+{
+    if (::chdir(m_start_dir.c_str()) != 0) {
+        amrex::Abort("ensemble: cannot return to " + m_start_dir);
+    }
+}
+
+void Ensemble::finish (double seconds)
+{
+#ifdef AMREX_USE_MPI
+    if (m_comm != MPI_COMM_WORLD) MPI_Comm_free(&m_comm);
+    double seconds_max = seconds;
+    MPI_Reduce(&seconds, &seconds_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    seconds = seconds_max;
+#endif
+    if (m_rank == 0) {
+        std::cout << "Ensemble of " << m_nmembers << " members finished in " << seconds << " seconds\n";
+    }
+}
@@ -0,0 +1,695 @@
+#include "EvolveM.H"
+#include "MagLaplacian.H"
+
+#ifdef AMREX_USE_OMP
+#include <omp.h>
+#endif
+
+#include <utility>
+
+/**
+ * Compile-time set of coupling flags; terms switched off here are removed from the
+ * instantiated kernel instead of being tested per cell */
+template <bool Demag, bool Exchange, bool Anisotropy, bool Saturated, bool Thermal = false>
+struct CouplingSet
+{
+    static constexpr bool demag = Demag;
+    static constexpr bool exchange = Exchange;
+    static constexpr bool anisotropy = Anisotropy;
+    // M_normalization != 0: damping uses Ms instead of the local |M|
+    static constexpr bool saturated = Saturated;
+    // temperature > 0: stochastic thermal field (LLG right-hand side only)
+    static constexpr bool thermal = Thermal;
+};
+
+void ComputeLLGRHSReference(Array<MagMultiFab, AMREX_SPACEDIM>& LLG_RHS,
+                   Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                   Array<MagMultiFab, AMREX_SPACEDIM>& Hfield,
+                   const AppliedField&                 applied,
+                   Real                                time,
+                   const Materials&                    materials,
+                   int                                 demag_coupling,
+                   int                                 exchange_coupling,
+                   int                                 anisotropy_coupling,
+                   int                                 M_normalization,
+                   Real                                mu0,
+                   amrex::GpuArray<amrex::Real, 3>     anisotropy_axis,
+                   const Geometry&                     geom)
+{
+    // the time profile is the same in every cell
+    Real const f = applied.timeFactor(time);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+        for (MFIter mfi(Mfield[0], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+       
+              const Box& bx = mfi.tilebox(); 
+
+        // extract field data
+              // Hfield is only allocated when demag is coupled
+              Array4<MagReal> Hx, Hy, Hz;
+              if (demag_coupling == 1) {
+                  Hx = Hfield[0].array(mfi);
+                  Hy = Hfield[1].array(mfi);
+                  Hz = Hfield[2].array(mfi);
+              }
+              Array4<MagReal> const &Mx = Mfield[0].array(mfi);         
+              Array4<MagReal> const &My = Mfield[1].array(mfi);         
+              Array4<MagReal> const &Mz = Mfield[2].array(mfi);         
+              Array4<MagReal> const &Mx_rhs = LLG_RHS[0].array(mfi); 
+              Array4<MagReal> const &My_rhs = LLG_RHS[1].array(mfi); 
+              Array4<MagReal> const &Mz_rhs = LLG_RHS[2].array(mfi); 
+          
+              const Array4<int const>& id_arr = materials.id().const_array(mfi);
+              MaterialTable const mat = materials.table();
+ 
+              amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+              {
+                 int const m = id_arr(i,j,k);
+                 if (m > 0)
+                 {
+                    amrex::Real Hx_eff, Hy_eff, Hz_eff;
+                    applied.eval(i, j, k, f, Hx_eff, Hy_eff, Hz_eff);
+                 
+                    if(demag_coupling == 1)
+                    {
+                      Hx_eff += Hx(i,j,k);
+                      Hy_eff += Hy(i,j,k);
+                      Hz_eff += Hz(i,j,k);
+                    }
+
+                    if(exchange_coupling == 1)
+                    { 
+                    //Add exchange term
+                      // H_exchange, in the single-material form; interfaces between
+                      // materials are only coupled correctly by ExchangeField_Mag
+                      amrex::Real const H_exchange_coeff = 2.0 * mat.exchange[m] / mu0 / mat.Ms[m] / mat.Ms[m];
+
+                      amrex::Real Ms_lo_x = mat.Ms[id_arr(i-1, j, k)]; 
+                      amrex::Real Ms_hi_x = mat.Ms[id_arr(i+1, j, k)]; 
+                      amrex::Real Ms_lo_y = mat.Ms[id_arr(i, j-1, k)]; 
+                      amrex::Real Ms_hi_y = mat.Ms[id_arr(i, j+1, k)]; 
+                      amrex::Real Ms_lo_z = mat.Ms[id_arr(i, j, k-1)];
+                      amrex::Real Ms_hi_z = mat.Ms[id_arr(i, j, k+1)];
+
+                      Hx_eff += H_exchange_coeff * Laplacian_Mag(Mx, Ms_lo_x, Ms_hi_x, Ms_lo_y, Ms_hi_y, Ms_lo_z, Ms_hi_z, i, j, k, geom);
+                      Hy_eff += H_exchange_coeff * Laplacian_Mag(My, Ms_lo_x, Ms_hi_x, Ms_lo_y, Ms_hi_y, Ms_lo_z, Ms_hi_z, i, j, k, geom);
+                      Hz_eff += H_exchange_coeff * Laplacian_Mag(Mz, Ms_lo_x, Ms_hi_x, Ms_lo_y, Ms_hi_y, Ms_lo_z, Ms_hi_z, i, j, k, geom);
+
+                    }
+                 
+                    if(anisotropy_coupling == 1)
+                    {
+                     //Add anisotropy term
+
+                      // H_anisotropy
+                      amrex::Real M_dot_anisotropy_axis = 0.0;
+                      M_dot_anisotropy_axis = Mx(i, j, k) * anisotropy_axis[0] + My(i, j, k) * anisotropy_axis[1] + Mz(i, j, k) * anisotropy_axis[2];
+                      amrex::Real const H_anisotropy_coeff = - 2.0 * mat.anisotropy[m] / mu0 / mat.Ms[m] / mat.Ms[m];
+                      Hx_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[0];
+                      Hy_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[1];
+                      Hz_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[2];
+
+                    }
+
+                   //dM/dt
+
+                   amrex::Real mag_gammaL = mat.gamma[m] / (1._rt + std::pow(mat.alpha[m], 2._rt));
+
+                   // 0 = unsaturated; compute |M| locally.  1 = saturated; use M_s 
+                   amrex::Real M_magnitude = (M_normalization == 0) ? std::sqrt(std::pow(Mx(i, j, k), 2._rt) + std::pow(My(i, j, k), 2._rt) + std::pow(Mz(i, j, k), 2._rt))
+                                                             : mat.Ms[m];
+                   amrex::Real Gil_damp = mu0 * mag_gammaL * mat.alpha[m] / M_magnitude;
+
+                   // x component on cell-centers
+                   Mx_rhs(i, j, k) = (mu0 * mag_gammaL) * (My(i, j, k) * Hz_eff - Mz(i, j, k) * Hy_eff)
+                                        + Gil_damp * (My(i, j, k) * (Mx(i, j, k) * Hy_eff - My(i, j, k) * Hx_eff)
+                                        - Mz(i, j, k) * (Mz(i, j, k) * Hx_eff - Mx(i, j, k) * Hz_eff));
+
+                   // y component on cell-centers
+                   My_rhs(i, j, k) = (mu0 * mag_gammaL) * (Mz(i, j, k) * Hx_eff - Mx(i, j, k) * Hz_eff)
+                                        + Gil_damp * (Mz(i, j, k) * (My(i, j, k) * Hz_eff - Mz(i, j, k) * Hy_eff)
+                                        - Mx(i, j, k) * (Mx(i, j, k) * Hy_eff - My(i, j, k) * Hx_eff));
+
+                   // z component on cell-centers
+                   Mz_rhs(i, j, k) = (mu0 * mag_gammaL) * (Mx(i, j, k) * Hy_eff - My(i, j, k) * Hx_eff)
+                                        + Gil_damp * (Mx(i, j, k) * (Mz(i, j, k) * Hx_eff - Mx(i, j, k) * Hz_eff)
+                                        - My(i, j, k) * (My(i, j, k) * Hz_eff - Mz(i, j, k) * Hy_eff));
+                 } else {
+                   Mx_rhs(i, j, k) = 0._rt;
+                   My_rhs(i, j, k) = 0._rt;
+                   Mz_rhs(i, j, k) = 0._rt;
+                 }
+              });     
+        }  
+}
+
+// Disjoint slabs covering the cells of valid that are within one cell of its faces
+static Array<Box, 2*AMREX_SPACEDIM> BoundarySlabs (const Box& valid)
+{
+    Array<Box, 2*AMREX_SPACEDIM> slabs;
+    Box rest = valid;
+    for (int idim = 0; idim < AMREX_SPACEDIM; ++idim)
+    {
+        if (!rest.ok()) break;
+
+        Box lo = rest;
+        lo.setBig(idim, rest.smallEnd(idim));
+        slabs[2*idim] = lo;
+
+        if (rest.length(idim) > 1) {
+            Box hi = rest;
+            hi.setSmall(idim, rest.bigEnd(idim));
+            slabs[2*idim+1] = hi;
+        }
+
+        rest.grow(idim, -1);
+    }
+    return slabs;
+}
+
+// Effective field of a magnetic cell from the terms of Couplings; shared by the LLG
+// right-hand side and the relaxation direction
+template <class Couplings>
+AMREX_GPU_HOST_DEVICE AMREX_FORCE_INLINE
+void EffectiveField (int const i, int const j, int const k, int const m,
+                     Array4<MagReal> const& Mx, Array4<MagReal> const& My, Array4<MagReal> const& Mz,
+                     Array4<MagReal> const& Hx, Array4<MagReal> const& Hy, Array4<MagReal> const& Hz,
+                     AppliedField const& applied, amrex::Real const f,
+                     MaterialTable const& mat,
+                     Array4<int const> const& id_arr,
+                     Array4<int const> const& mask_arr,
+                     GpuArray<Real,AMREX_SPACEDIM> const& inv_dx2,
+                     amrex::GpuArray<amrex::Real, 3> const& anisotropy_axis,
+                     amrex::Real& Hx_eff, amrex::Real& Hy_eff, amrex::Real& Hz_eff)
+{
+    applied.eval(i, j, k, f, Hx_eff, Hy_eff, Hz_eff);
+ 
+    if constexpr (Couplings::demag)
+    {
+      Hx_eff += Hx(i,j,k);
+      Hy_eff += Hy(i,j,k);
+      Hz_eff += Hz(i,j,k);
+    }
+
+    if constexpr (Couplings::exchange)
+    { 
+    //Add exchange term
+
+      // H_exchange
+      amrex::Real H_ex_x, H_ex_y, H_ex_z;
+      ExchangeField_Mag(Mx, My, Mz, id_arr, mat, m, mask_arr(i,j,k), inv_dx2, i, j, k, H_ex_x, H_ex_y, H_ex_z);
+
+      Hx_eff += H_ex_x;
+      Hy_eff += H_ex_y;
+      Hz_eff += H_ex_z;
+
+    }
+ 
+    if constexpr (Couplings::anisotropy)
+    {
+     //Add anisotropy term
+
+      // H_anisotropy
+      amrex::Real M_dot_anisotropy_axis = 0.0;
+      M_dot_anisotropy_axis = Mx(i, j, k) * anisotropy_axis[0] + My(i, j, k) * anisotropy_axis[1] + Mz(i, j, k) * anisotropy_axis[2];
+      amrex::Real const H_anisotropy_coeff = mat.anisotropy_coeff[m];
+      Hx_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[0];
+      Hy_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[1];
+      Hz_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[2];
+
+    }
+}
+
+// Run f over the cells of tile bx selected by region; needs_neighbors is false when
+// no cell reads outside itself, so every cell counts as interior
+template <class F>
+void ForTileRegion (const Box& bx, const Box& valid, TileRegion region, bool needs_neighbors, F const& f)
+{
+    if (!needs_neighbors || region == TileRegion::All) {
+        if (region != TileRegion::Boundary) amrex::ParallelFor(bx, f);
+    } else if (region == TileRegion::Interior) {
+        amrex::ParallelFor(bx & amrex::grow(valid, -1), f);
+    } else {
+        for (const Box& slab : BoundarySlabs(valid)) {
+            amrex::ParallelFor(bx & slab, f);
+        }
+    }
+}
+
+// LLG right-hand side with the terms of Couplings resolved at compile time
+template <class Couplings>
+void ComputeLLGRHSKernel(Array<MagMultiFab, AMREX_SPACEDIM>& LLG_RHS,
+                   Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                   Array<MagMultiFab, AMREX_SPACEDIM>& Hfield,
+                   const AppliedField&                 applied,
+                   Real                                time,
+                   const ThermalField&                 thermal,
+                   const Materials&                    materials,
+                   const ExchangeStencil&              stencil,
+                   Real                                /*mu0*/,
+                   amrex::GpuArray<amrex::Real, 3>     anisotropy_axis,
+                   const Geometry&                     geom,
+                   TileRegion                          region)
+{
+    BL_PROFILE("ComputeLLGRHSKernel()");
+
+    // the time profile is the same in every cell
+    Real const f = applied.timeFactor(time);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+        for (MFIter mfi(Mfield[0], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+       
+              const Box& bx = mfi.tilebox(); 
+
+        // extract field data
+              // Hfield is only allocated when demag is coupled
+              Array4<MagReal> Hx, Hy, Hz;
+              if constexpr (Couplings::demag) {
+                  Hx = Hfield[0].array(mfi);
+                  Hy = Hfield[1].array(mfi);
+                  Hz = Hfield[2].array(mfi);
+              }
+              Array4<MagReal> const &Mx = Mfield[0].array(mfi);         
+              Array4<MagReal> const &My = Mfield[1].array(mfi);         
+              Array4<MagReal> const &Mz = Mfield[2].array(mfi);         
+              Array4<MagReal> const &Mx_rhs = LLG_RHS[0].array(mfi); 
+              Array4<MagReal> const &My_rhs = LLG_RHS[1].array(mfi); 
+              Array4<MagReal> const &Mz_rhs = LLG_RHS[2].array(mfi); 
+          
+              // one 4-byte ID per cell; the constants come from the table in the kernel parameters
+              const Array4<int const>& id_arr = materials.id().const_array(mfi);
+              MaterialTable const mat = materials.table();
+              const Array4<int const>& mask_arr = stencil.mask().const_array(mfi);
+              GpuArray<Real,AMREX_SPACEDIM> const inv_dx2 = stencil.invDx2();
+ 
+              auto llg_rhs = [=] AMREX_GPU_DEVICE (int i, int j, int k)
+              {
+                 int const m = id_arr(i,j,k);
+                 if (m > 0)
+                 {
+                    amrex::Real Hx_eff, Hy_eff, Hz_eff;
+                    EffectiveField<Couplings>(i, j, k, m, Mx, My, Mz, Hx, Hy, Hz, applied, f, mat,
+                                              id_arr, mask_arr, inv_dx2, anisotropy_axis, Hx_eff, Hy_eff, Hz_eff);
+
+                    if constexpr (Couplings::thermal)
+                    {
+                      amrex::Real Hx_th, Hy_th, Hz_th;
+                      thermal.eval(i, j, k, m, Hx_th, Hy_th, Hz_th);
+                      Hx_eff += Hx_th;
+                      Hy_eff += Hy_th;
+                      Hz_eff += Hz_th;
+                    }
+
+                   //dM/dt
+
+                   // mu0 * gamma / (1 + alpha^2)
+                   amrex::Real const precession = mat.precession[m];
+
+                   // 0 = unsaturated; compute |M| locally.  1 = saturated; use M_s 
+                   amrex::Real M_magnitude;
+                   if constexpr (Couplings::saturated) {
+                       M_magnitude = mat.Ms[m];
+                   } else {
+                       M_magnitude = std::sqrt(std::pow(Mx(i, j, k), 2._rt) + std::pow(My(i, j, k), 2._rt) + std::pow(Mz(i, j, k), 2._rt));
+                   }
+                   amrex::Real Gil_damp = mat.damping[m] / M_magnitude;
+
+                   // x component on cell-centers
+                   Mx_rhs(i, j, k) = precession * (My(i, j, k) * Hz_eff - Mz(i, j, k) * Hy_eff)
+                                        + Gil_damp * (My(i, j, k) * (Mx(i, j, k) * Hy_eff - My(i, j, k) * Hx_eff)
+                                        - Mz(i, j, k) * (Mz(i, j, k) * Hx_eff - Mx(i, j, k) * Hz_eff));
+
+                   // y component on cell-centers
+                   My_rhs(i, j, k) = precession * (Mz(i, j, k) * Hx_eff - Mx(i, j, k) * Hz_eff)
+                                        + Gil_damp * (Mz(i, j, k) * (My(i, j, k) * Hz_eff - Mz(i, j, k) * Hy_eff)
+                                        - Mx(i, j, k) * (Mx(i, j, k) * Hy_eff - My(i, j, k) * Hx_eff));
+
+                   // z component on cell-centers
+                   Mz_rhs(i, j, k) = precession * (Mx(i, j, k) * Hy_eff - My(i, j, k) * Hx_eff)
+                                        + Gil_damp * (Mx(i, j, k) * (Mz(i, j, k) * Hx_eff - Mx(i, j, k) * Hz_eff)
+                                        - My(i, j, k) * (My(i, j, k) * Hz_eff - Mz(i, j, k) * Hy_eff));
+                 } else {
+                   Mx_rhs(i, j, k) = 0._rt;
+                   My_rhs(i, j, k) = 0._rt;
+                   Mz_rhs(i, j, k) = 0._rt;
+                 }
+              };
+
+              // without exchange no cell reads its neighbors
+              ForTileRegion(bx, mfi.validbox(), region, Couplings::exchange, llg_rhs);
+        }  
+}
+
+// Relaxation direction G = M x (M x H_eff) / Ms^2, the energy gradient projected on
+// the tangent plane of the unit sphere (in A/m); zero in non-magnetic cells.  Same
+// signature as the LLG right-hand side, with the damping and precession constants
+// unused.
+template <class Couplings>
+void ComputeRelaxDirectionKernel(Array<MagMultiFab, AMREX_SPACEDIM>& G,
+                   Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                   Array<MagMultiFab, AMREX_SPACEDIM>& Hfield,
+                   const AppliedField&                 applied,
+                   Real                                time,
+                   const ThermalField&                 /*thermal*/,
+                   const Materials&                    materials,
+                   const ExchangeStencil&              stencil,
+                   Real                                /*mu0*/,
+                   amrex::GpuArray<amrex::Real, 3>     anisotropy_axis,
+                   const Geometry&                     /*geom*/,
+                   TileRegion                          region)
+{
+    BL_PROFILE("ComputeRelaxDirectionKernel()");
+
+    // the time profile is the same in every cell
+    Real const f = applied.timeFactor(time);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+        for (MFIter mfi(Mfield[0], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+              const Box& bx = mfi.tilebox();
+
+              Array4<MagReal> Hx, Hy, Hz;
+              if constexpr (Couplings::demag) {
+                  Hx = Hfield[0].array(mfi);
+                  Hy = Hfield[1].array(mfi);
+                  Hz = Hfield[2].array(mfi);
+              }
+              Array4<MagReal> const &Mx = Mfield[0].array(mfi);
+              Array4<MagReal> const &My = Mfield[1].array(mfi);
+              Array4<MagReal> const &Mz = Mfield[2].array(mfi);
+              Array4<MagReal> const &Gx = G[0].array(mfi);
+              Array4<MagReal> const &Gy = G[1].array(mfi);
+              Array4<MagReal> const &Gz = G[2].array(mfi);
+
+              const Array4<int const>& id_arr = materials.id().const_array(mfi);
+              MaterialTable const mat = materials.table();
+              const Array4<int const>& mask_arr = stencil.mask().const_array(mfi);
+              GpuArray<Real,AMREX_SPACEDIM> const inv_dx2 = stencil.invDx2();
+
+              auto relax_direction = [=] AMREX_GPU_DEVICE (int i, int j, int k)
+              {
+                 int const m = id_arr(i,j,k);
+                 if (m > 0)
+                 {
+                    amrex::Real Hx_eff, Hy_eff, Hz_eff;
+                    EffectiveField<Couplings>(i, j, k, m, Mx, My, Mz, Hx, Hy, Hz, applied, f, mat,
+                                              id_arr, mask_arr, inv_dx2, anisotropy_axis, Hx_eff, Hy_eff, Hz_eff);
+
+                    amrex::Real const inv_Ms2 = 1._rt / (mat.Ms[m] * mat.Ms[m]);
+                    amrex::Real const tx = My(i,j,k) * Hz_eff - Mz(i,j,k) * Hy_eff;
+                    amrex::Real const ty = Mz(i,j,k) * Hx_eff - Mx(i,j,k) * Hz_eff;
+                    amrex::Real const tz = Mx(i,j,k) * Hy_eff - My(i,j,k) * Hx_eff;
+
+                    Gx(i,j,k) = (My(i,j,k) * tz - Mz(i,j,k) * ty) * inv_Ms2;
+                    Gy(i,j,k) = (Mz(i,j,k) * tx - Mx(i,j,k) * tz) * inv_Ms2;
+                    Gz(i,j,k) = (Mx(i,j,k) * ty - My(i,j,k) * tx) * inv_Ms2;
+                 } else {
+                    Gx(i,j,k) = 0._rt;
+                    Gy(i,j,k) = 0._rt;
+                    Gz(i,j,k) = 0._rt;
+                 }
+              };
+
+              ForTileRegion(bx, mfi.validbox(), region, Couplings::exchange, relax_direction);
+        }
+}
+
+template <bool Relax, int key>
+constexpr LLGRHSFunction LLGRHSKernelFor ()
+{
+    using Couplings = CouplingSet<(key & 1) != 0, (key & 2) != 0, (key & 4) != 0, (key & 8) != 0, (key & 16) != 0>;
+    if constexpr (Relax) {
+        return &ComputeRelaxDirectionKernel<Couplings>;
+    } else {
+        return &ComputeLLGRHSKernel<Couplings>;
+    }
+}
+
+template <bool Relax, int... keys>
+LLGRHSFunction LLGRHSKernelTable (int key, std::integer_sequence<int, keys...>)
+{
+    static constexpr LLGRHSFunction table[] = {LLGRHSKernelFor<Relax, keys>()...};
+    return table[key];
+}
+
+static int CouplingKey (int demag_coupling, int exchange_coupling, int anisotropy_coupling, int M_normalization)
+{
+    return  (demag_coupling == 1 ? 1 : 0)
+          | (exchange_coupling == 1 ? 2 : 0)
+          | (anisotropy_coupling == 1 ? 4 : 0)
+          | (M_normalization != 0 ? 8 : 0);
+}
+
+LLGRHSFunction SelectLLGRHS(int demag_coupling,
+                            int exchange_coupling,
+                            int anisotropy_coupling,
+                            int M_normalization,
+                            bool thermal)
+{
+    int const key = CouplingKey(demag_coupling, exchange_coupling, anisotropy_coupling, M_normalization)
+                  | (thermal ? 16 : 0);
+    return LLGRHSKernelTable<false>(key, std::make_integer_sequence<int, 32>{});
+}
+
+LLGRHSFunction SelectRelaxDirection(int demag_coupling,
+                                    int exchange_coupling,
+                                    int anisotropy_coupling)
+{
+    return LLGRHSKernelTable<true>(CouplingKey(demag_coupling, exchange_coupling, anisotropy_coupling, 0),
+                                   std::make_integer_sequence<int, 8>{});
+}
+
+void InitializeM(Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                 const Materials&                    materials,
+                 const Geometry&                     geom)
+{
+    GpuArray<Real,AMREX_SPACEDIM> const prob_lo = geom.ProbLoArray();
+    GpuArray<Real,AMREX_SPACEDIM> const dx = geom.CellSizeArray();
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+    for (MFIter mfi(Mfield[0], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+    {
+          const Box& bx = mfi.tilebox();
+
+          Array4<MagReal> const &Mx = Mfield[0].array(mfi);
+          Array4<MagReal> const &My = Mfield[1].array(mfi);
+          Array4<MagReal> const &Mz = Mfield[2].array(mfi);
+
+          const Array4<int const>& id_arr = materials.id().const_array(mfi);
+
+          amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+          {
+             if (id_arr(i,j,k) > 0)
+             {
+                Real y = prob_lo[1] + (j+0.5) * dx[1];
+
+                Mx(i,j,k) = (y < 0) ? 1.4e5 : 0.;
+                My(i,j,k) = 0._rt;
+                Mz(i,j,k) = (y >= 0) ? 1.4e5 : 0.;
+             } else {
+                Mx(i,j,k) = 0.0;
+                My(i,j,k) = 0.0;
+                Mz(i,j,k) = 0.0;
+             }
+          });
+    }
+}
+
+void NormalizeM(Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                const Materials&                    materials,
+                int                                 M_normalization)
+{
+    BL_PROFILE("NormalizeM()");
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+        for (MFIter mfi(Mfield[0], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+              const Box& bx = mfi.tilebox(); 
+
+              Array4<MagReal> const &Mx = Mfield[0].array(mfi);         
+              Array4<MagReal> const &My = Mfield[1].array(mfi);         
+              Array4<MagReal> const &Mz = Mfield[2].array(mfi);         
+              const Array4<int const>& id_arr = materials.id().const_array(mfi);
+              MaterialTable const mat = materials.table();
+
+              amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+              {
+                 int const m = id_arr(i,j,k);
+                 if (m > 0)
+                 {
+                   // temporary normalized magnitude of M field at the fixed point
+                   amrex::Real M_magnitude_normalized = std::sqrt(std::pow(Mx(i, j, k), 2._rt) + std::pow(My(i, j, k), 2._rt) + std::pow(Mz(i, j, k), 2._rt)) / mat.Ms[m];
+
+                   amrex::Real normalized_error = 0.1;
+
+                   if (M_normalization > 0)
+                   {
+                       // saturated case; if |M| has drifted from M_s too much, abort.  Otherwise, normalize
+                       // check the normalized error
+                       if (amrex::Math::abs(1._rt - M_magnitude_normalized) > normalized_error)
+                       {
+                           amrex::Print() << "M_magnitude_normalized = " << M_magnitude_normalized << "\n";
+                           amrex::Abort("Exceed the normalized error of the Mx field");
+                       }
+                       // normalize the M field
+                       Mx(i, j, k) /= M_magnitude_normalized;
+                       My(i, j, k) /= M_magnitude_normalized;
+                       Mz(i, j, k) /= M_magnitude_normalized;
+                   }
+                   else if (M_normalization == 0)
+                   {   
+                       // check the normalized error
+                       if (M_magnitude_normalized > (1._rt + normalized_error))
+                       {
+                           amrex::Abort("Caution: Unsaturated material has M_xface exceeding the saturation magnetization");
+                       }
+                       else if (M_magnitude_normalized > 1._rt && M_magnitude_normalized <= (1._rt + normalized_error) )
+                       {
+                           // normalize the M field
+                           Mx(i, j, k) /= M_magnitude_normalized;
+                           My(i, j, k) /= M_magnitude_normalized;
+                           Mz(i, j, k) /= M_magnitude_normalized;
+                       }
+                   }
+                 }
+              });
+        }
+}
+
+void LLGKernelBenchmark(Array<MagMultiFab, AMREX_SPACEDIM>& LLG_RHS,
+                        Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                        Array<MagMultiFab, AMREX_SPACEDIM>& Hfield,
+                        const AppliedField&                 applied,
+                        const Materials&                    materials,
+                        const ExchangeStencil&              stencil,
+                        Real                                mu0,
+                        amrex::GpuArray<amrex::Real, 3>     anisotropy_axis,
+                        const Geometry&                     geom,
+                        int                                 nrepeat)
+{
+    Real const ncells = static_cast<Real>(geom.Domain().numPts());
+
+    // only time the combinations the materials can run
+    MaterialTable const& mat = materials.table();
+    bool has_exchange = true;
+    bool has_anisotropy = false;
+    for (int m = 1; m <= materials.numMaterials(); ++m)
+    {
+        if (mat.exchange[m] == 0.) has_exchange = false;
+        if (mat.anisotropy[m] != 0.) has_anisotropy = true;
+    }
+
+    amrex::Print() << "==================== LLG Kernel Benchmark ====================\n";
+    amrex::Print() << " demag exchange anisotropy saturated | runtime flags | specialized (cell-updates/s)\n";
+
+    for (int key = 0; key < 16; key++)
+    {
+        int const demag_coupling = (key & 1) ? 1 : 0;
+        int const exchange_coupling = (key & 2) ? 1 : 0;
+        int const anisotropy_coupling = (key & 4) ? 1 : 0;
+        int const M_normalization = (key & 8) ? 1 : 0;
+
+        if (demag_coupling == 1 && !Hfield[0].ok()) continue;
+        if (exchange_coupling == 1 && !has_exchange) continue;
+        if (anisotropy_coupling == 1 && !has_anisotropy) continue;
+
+        Real ref_time = ParallelDescriptor::second();
+        for (int n = 0; n < nrepeat; n++)
+        {
+            ComputeLLGRHSReference(LLG_RHS, Mfield, Hfield, applied, 0., materials,
+                                   demag_coupling, exchange_coupling, anisotropy_coupling, M_normalization,
+                                   mu0, anisotropy_axis, geom);
+        }
+        Gpu::streamSynchronize();
+        ref_time = ParallelDescriptor::second() - ref_time;
+        ParallelDescriptor::ReduceRealMax(ref_time);
+
+        LLGRHSFunction kernel = SelectLLGRHS(demag_coupling, exchange_coupling, anisotropy_coupling, M_normalization, false);
+
+        Real spec_time = ParallelDescriptor::second();
+        for (int n = 0; n < nrepeat; n++)
+        {
+            kernel(LLG_RHS, Mfield, Hfield, applied, 0., ThermalField{}, materials, stencil,
+                   mu0, anisotropy_axis, geom, TileRegion::All);
+        }
+        Gpu::streamSynchronize();
+        spec_time = ParallelDescriptor::second() - spec_time;
+        ParallelDescriptor::ReduceRealMax(spec_time);
+
+        amrex::Print() << "   " << demag_coupling << "       " << exchange_coupling << "        "
+                       << anisotropy_coupling << "          " << M_normalization << "     | "
+                       << ncells * nrepeat / ref_time << " | "
+                       << ncells * nrepeat / spec_time << "\n";
+    }
+    amrex::Print() << "==============================================================\n";
+}
+
+void ThreadScalingBenchmark(LLGRHSFunction                      kernel,
+                            Array<MagMultiFab, AMREX_SPACEDIM>& LLG_RHS,
+                            Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                            Array<MagMultiFab, AMREX_SPACEDIM>& Hfield,
+                            const AppliedField&                 applied,
+                            const Materials&                    materials,
+                            const ExchangeStencil&              stencil,
+                            Real                                mu0,
+                            amrex::GpuArray<amrex::Real, 3>     anisotropy_axis,
+                            int                                 M_normalization,
+                            const Geometry&                     geom,
+                            int                                 nrepeat)
+{
+#ifdef AMREX_USE_OMP
+    Real const ncells = static_cast<Real>(Mfield[0].boxArray().numPts());
+    int const max_threads = omp_get_max_threads();
+
+    Vector<int> nthreads_list;
+    for (int nthreads = 1; nthreads < max_threads; nthreads *= 2) nthreads_list.push_back(nthreads);
+    nthreads_list.push_back(max_threads);
+
+    amrex::Print() << "==================== Thread Scaling ====================\n";
+    amrex::Print() << " threads | seconds per update | cell-updates/s | speedup | efficiency\n";
+
+    Real time_1 = 0.;
+    for (int nthreads : nthreads_list)
+    {
+        omp_set_num_threads(nthreads);
+
+        // untimed pass to settle thread start-up and first touch
+        kernel(LLG_RHS, Mfield, Hfield, applied, 0., ThermalField{}, materials, stencil,
+               mu0, anisotropy_axis, geom, TileRegion::All);
+
+        Real time = ParallelDescriptor::second();
+        for (int n = 0; n < nrepeat; n++)
+        {
+            kernel(LLG_RHS, Mfield, Hfield, applied, 0., ThermalField{}, materials, stencil,
+                   mu0, anisotropy_axis, geom, TileRegion::All);
+            NormalizeM(Mfield, materials, M_normalization);
+        }
+        time = (ParallelDescriptor::second() - time) / nrepeat;
+        ParallelDescriptor::ReduceRealMax(time);
+
+        if (nthreads == 1) time_1 = time;
+
+        amrex::Print() << " " << nthreads << " | " << time << " | " << ncells / time << " | "
+                       << time_1 / time << " | " << time_1 / (time * nthreads) << "\n";
+    }
+    amrex::Print() << "========================================================\n";
+
+    omp_set_num_threads(max_threads);
+#else
+    amrex::ignore_unused(kernel, LLG_RHS, Mfield, Hfield, applied, materials,
+                         stencil, mu0, anisotropy_axis, M_normalization, geom, nrepeat);
+    amrex::Print() << "Thread scaling benchmark skipped: built without OpenMP\n";
+#endif
+}
@@ -0,0 +1,48 @@
+#include "ExchangeStencil.H"
+
+ExchangeStencil::ExchangeStencil (const iMultiFab& material_id, const Geometry& geom)
+    : m_mask(material_id.boxArray(), material_id.DistributionMap(), 1, 0)
+{
+    GpuArray<Real,AMREX_SPACEDIM> dx = geom.CellSizeArray();
+    for (int idim = 0; idim < AMREX_SPACEDIM; ++idim) {
+        m_inv_dx2[idim] = 1. / (dx[idim] * dx[idim]);
+    }
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+    for (MFIter mfi(m_mask, TilingIfNotGPU()); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.tilebox();
+
+        const Array4<int>& mask_arr = m_mask.array(mfi);
+        const Array4<int const>& id_arr = material_id.const_array(mfi);
+
+        amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+        {
+            int const m = id_arr(i,j,k);
+            int mask = 0;
+            for (int idim = 0; idim < AMREX_SPACEDIM; ++idim)
+            {
+                int const di = (idim == 0) ? 1 : 0;
+                int const dj = (idim == 1) ? 1 : 0;
+                int const dk = (idim == 2) ? 1 : 0;
+
+                int const m_hi = id_arr(i+di,j+dj,k+dk);
+                int const m_lo = id_arr(i-di,j-dj,k-dk);
+                bool const hi = m_hi > 0;
+                bool const lo = m_lo > 0;
+
+                // same cases as LaplacianD*_Mag: without an upper neighbor only the
+                // downward difference is kept
+                if (hi) mask |= 1 << (2*idim);
+                if (lo || !hi) mask |= 1 << (2*idim+1);
+
+                if (m > 0 && ((hi && m_hi != m) || (lo && m_lo != m))) {
+                    mask |= interface_bit;
+                }
+            }
+            mask_arr(i,j,k) = mask;
+        });
+    }
+}
@@ -0,0 +1,73 @@
+#include "FieldSweep.H"
+
+#include <AMReX_ParmParse.H>
+
+#include <fstream>
+
+FieldSweep::FieldSweep ()
+{
+    ParmParse pp("sweep");
+
+    pp.query("file", m_file);
+    pp.query("plot_int", m_plot_int);
+
+    Vector<Real> list;
+    if (pp.queryarr("H_points", list))
+    {
+        if (list.empty() || list.size() % 3 != 0) {
+            amrex::Abort("sweep.H_points must hold three components per field point");
+        }
+        for (int n = 0; n < static_cast<int>(list.size()); n += 3) {
+            m_points.push_back({list[n], list[n+1], list[n+2]});
+        }
+        return;
+    }
+
+    Vector<Real> H_start, H_end;
+    pp.getarr("H_start", H_start, 0, 3);
+    pp.getarr("H_end", H_end, 0, 3);
+    int npoints;
+    pp.get("npoints", npoints);
+    int loop = 1;
+    pp.query("loop", loop);
+    if (npoints < 2) {
+        amrex::Abort("sweep.npoints must be >= 2");
+    }
+
+    for (int n = 0; n < npoints; ++n)
+    {
+        Real const s = static_cast<Real>(n) / (npoints - 1);
+        m_points.push_back({H_start[0] + s * (H_end[0] - H_start[0]),
+                            H_start[1] + s * (H_end[1] - H_start[1]),
+                            H_start[2] + s * (H_end[2] - H_start[2])});
+    }
+    // the return branch, without repeating H_end
+    if (loop == 1)
+    {
+        for (int n = npoints - 2; n >= 0; --n) {
+            m_points.push_back(m_points[n]);
+        }
+    }
+}
+
+void FieldSweep::initFile () const
+{
+    if (!ParallelDescriptor::IOProcessor()) return;
+
+    std::ofstream ofs(m_file, std::ofstream::out | std::ofstream::trunc);
+    if (!ofs.good()) amrex::FileOpenFailed(m_file);
+    ofs << "point,Hx,Hy,Hz,Mx_avg,My_avg,Mz_avg,E_total,max_torque,iterations,converged,seconds\n";
+}
+
+void FieldSweep::write (int p, const MagneticDiagnostics& diag, int niter, bool converged, Real seconds) const
+{
+    if (!ParallelDescriptor::IOProcessor()) return;
+
+    std::ofstream ofs(m_file, std::ofstream::out | std::ofstream::app);
+    if (!ofs.good()) amrex::FileOpenFailed(m_file);
+    ofs.precision(12);
+    ofs << p << "," << m_points[p][0] << "," << m_points[p][1] << "," << m_points[p][2] << ","
+        << diag.M_avg[0] << "," << diag.M_avg[1] << "," << diag.M_avg[2] << ","
+        << diag.totalEnergy() << "," << diag.max_torque << ","
+        << niter << "," << (converged ? 1 : 0) << "," << seconds << "\n";
+}
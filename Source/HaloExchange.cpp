@@ -0,0 +1,100 @@
+#include "HaloExchange.H"
+
+void MagnetizationHalo::addPacked (Array<MagMultiFab, AMREX_SPACEDIM>& M, MagMultiFab& packed)
+{
+    AMREX_ALWAYS_ASSERT(packed.nComp() == AMREX_SPACEDIM);
+    m_packed.push_back(std::make_pair(&M[0], &packed));
+}
+
+MagMultiFab* MagnetizationHalo::packedFor (Array<MagMultiFab, AMREX_SPACEDIM>& M)
+{
+    for (auto const& p : m_packed) {
+        if (p.first == &M[0]) return p.second;
+    }
+    return nullptr;
+}
+
+void MagnetizationHalo::start (Array<MagMultiFab, AMREX_SPACEDIM>& M)
+{
+    BL_PROFILE("MagnetizationHalo::start()");
+
+    finish();
+
+    Real strt_time = ParallelDescriptor::second();
+
+    m_pending_packed = packedFor(M);
+    if (m_pending_packed) {
+        m_pending_packed->FillBoundary_nowait(m_geom.periodicity());
+    } else {
+        m_pending = &M;
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            M[dir].FillBoundary_nowait(m_geom.periodicity());
+        }
+    }
+    ++m_nexchanges;
+
+    m_exposed_time += ParallelDescriptor::second() - strt_time;
+}
+
+void MagnetizationHalo::finish ()
+{
+    BL_PROFILE("MagnetizationHalo::finish()");
+
+    if (!m_pending_packed && !m_pending) return;
+
+    Real strt_time = ParallelDescriptor::second();
+
+    if (m_pending_packed) {
+        m_pending_packed->FillBoundary_finish();
+    } else {
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            (*m_pending)[dir].FillBoundary_finish();
+        }
+    }
+    m_pending_packed = nullptr;
+    m_pending = nullptr;
+
+    m_exposed_time += ParallelDescriptor::second() - strt_time;
+}
+
+void MagnetizationHalo::calibrate (Array<MagMultiFab, AMREX_SPACEDIM>& M, int nrepeat)
+{
+    finish();
+
+    MagMultiFab* packed = packedFor(M);
+
+    ParallelDescriptor::Barrier();
+    Real strt_time = ParallelDescriptor::second();
+    for (int n = 0; n < nrepeat; n++)
+    {
+        if (packed) {
+            packed->FillBoundary(m_geom.periodicity());
+        } else {
+            for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+            {
+                M[dir].FillBoundary(m_geom.periodicity());
+            }
+        }
+    }
+    m_blocking_time = (ParallelDescriptor::second() - strt_time) / nrepeat;
+    ParallelDescriptor::ReduceRealMax(m_blocking_time);
+}
+
+Real MagnetizationHalo::hiddenFraction () const
+{
+    if (m_blocking_time <= 0. || m_nexchanges == 0) return 0.;
+
+    Real exposed = m_exposed_time / m_nexchanges;
+    ParallelDescriptor::ReduceRealMax(exposed);
+    return amrex::max(0., 1. - exposed / m_blocking_time);
+}
+
+void MagnetizationHalo::report () const
+{
+    Real const hidden = hiddenFraction();
+    amrex::Print() << "Ghost exchanges " << m_nexchanges << " on " << ParallelDescriptor::NProcs()
+                   << " ranks, blocking exchange " << m_blocking_time
+                   << " seconds, hidden communication fraction " << hidden << "\n";
+}
@@ -0,0 +1,119 @@
+#include "ImplicitExchange.H"
+
+ImplicitExchange::ImplicitExchange (const Geometry& geom, const BoxArray& ba, const DistributionMapping& dm,
+                                    const Materials& materials, Real tol_rel)
+    : m_tol_rel(tol_rel)
+{
+    // periodic where the domain is, free surfaces elsewhere
+    std::array<LinOpBCType, AMREX_SPACEDIM> lo_bc;
+    std::array<LinOpBCType, AMREX_SPACEDIM> hi_bc;
+    for (int idim = 0; idim < AMREX_SPACEDIM; ++idim) {
+        if (geom.isPeriodic(idim)) {
+            lo_bc[idim] = hi_bc[idim] = LinOpBCType::Periodic;
+        } else {
+            lo_bc[idim] = hi_bc[idim] = LinOpBCType::Neumann;
+        }
+    }
+
+    LPInfo info;
+    m_mlabec = std::make_unique<MLABecLaplacian>(Vector<Geometry>{geom}, Vector<BoxArray>{ba},
+                                                 Vector<DistributionMapping>{dm}, info);
+    m_mlabec->setMaxOrder(2);
+    m_mlabec->setDomainBC(lo_bc, hi_bc);
+    m_mlabec->setLevelBC(0, nullptr);
+
+    m_acoef.define(ba, dm, 1, 0);
+    m_acoef.setVal(1.);
+
+    AMREX_D_TERM(m_bcoef[0].define(convert(ba,IntVect(AMREX_D_DECL(1,0,0))), dm, 1, 0);,
+                 m_bcoef[1].define(convert(ba,IntVect(AMREX_D_DECL(0,1,0))), dm, 1, 0);,
+                 m_bcoef[2].define(convert(ba,IntVect(AMREX_D_DECL(0,0,1))), dm, 1, 0););
+
+    // stabilization coefficient S = |gamma| A / (alpha Ms) per material,
+    // harmonic average on faces between two magnetic cells
+    MaterialTable const& mat = materials.table();
+    GpuArray<Real, MaterialTable::max_materials> S;
+    for (int m = 0; m < MaterialTable::max_materials; ++m) {
+        S[m] = (mat.Ms[m] > 0.) ? std::abs(mat.gamma[m]) * mat.exchange[m] / (mat.alpha[m] * mat.Ms[m]) : 0.;
+    }
+
+    for (int idim = 0; idim < AMREX_SPACEDIM; ++idim)
+    {
+        IntVect shift(AMREX_D_DECL(0,0,0));
+        shift[idim] = 1;
+
+        for (MFIter mfi(m_bcoef[idim]); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = mfi.validbox();
+
+            const Array4<Real>& beta = m_bcoef[idim].array(mfi);
+            const Array4<int const>& id_arr = materials.id().const_array(mfi);
+
+            amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+                int const il = i - shift[0];
+                int const jl = j - shift[1];
+                int const kl = k - shift[2];
+
+                Real const S_lo = S[id_arr(il,jl,kl)];
+                Real const S_hi = S[id_arr(i,j,k)];
+
+                beta(i,j,k) = (S_lo > 0._rt && S_hi > 0._rt) ? 2._rt * S_lo * S_hi / (S_lo + S_hi) : 0._rt;
+            });
+        }
+    }
+
+    m_mlabec->setACoeffs(0, m_acoef);
+    m_mlabec->setBCoeffs(0, amrex::GetArrOfConstPtrs(m_bcoef));
+
+    m_mlmg = std::make_unique<MLMG>(*m_mlabec);
+    m_mlmg->setVerbose(0);
+
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        m_dMdt[dir].define(ba, dm, 1, 0);
+    }
+    m_rhs.define(ba, dm, 1, 0);
+}
+
+void ImplicitExchange::Advance (Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                                Array<MagMultiFab, AMREX_SPACEDIM>& Mfield_old,
+                                const TimeIntegrator::RHSFunction& rhs,
+                                Real time,
+                                Real dt)
+{
+    BL_PROFILE("ImplicitExchange::Advance()");
+
+    if (dt != m_dt) {
+        // (A*acoef - B * div bcoef grad) M = rhs
+        m_mlabec->setScalars(1.0, dt);
+        m_dt = dt;
+    }
+
+    // explicit LLG right-hand side at t^n
+    rhs(Mfield_old, m_dMdt, time);
+
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        MultiFab& M_old = RealView(Mfield_old[dir], m_M_old_real);
+
+        // (I - dt div S grad) M^n + dt * f(M^n)
+        m_mlmg->apply({&m_rhs}, {&M_old});
+        MultiFab::Saxpy(m_rhs, dt, RealView(m_dMdt[dir], m_dMdt_real), 0, 0, 1, 0);
+
+        // M^n is the initial guess
+#ifdef MICROMAG_MIXED_PRECISION
+        MultiFab& M_new = m_M_real;
+        if (!M_new.ok()) M_new.define(M_old.boxArray(), M_old.DistributionMap(), 1, 1);
+        MultiFab::Copy(M_new, M_old, 0, 0, 1, 1);
+        m_mlmg->solve({&M_new}, {&m_rhs}, m_tol_rel, 0.);
+        ConvertCopy(Mfield[dir], M_new, 0, 0, 1, 1);
+#else
+        MultiFab::Copy(Mfield[dir], Mfield_old[dir], 0, 0, 1, 1);
+        m_mlmg->solve({&Mfield[dir]}, {&m_rhs}, m_tol_rel, 0.);
+#endif
+
+        m_iters += m_mlmg->getNumIters();
+        ++m_nsolves;
+    }
+}
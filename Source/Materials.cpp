@@ -0,0 +1,412 @@
+#include "Materials.H"
+
+#include <AMReX_ParmParse.H>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Materials::Materials (const Geometry& geom, const BoxArray& ba, const DistributionMapping& dm,
+                      int nghost, Real mu0)
+    : m_id(ba, dm, 1, nghost)
+{
+    for (int m = 0; m < MaterialTable::max_materials; ++m)
+    {
+        m_table.alpha[m] = 0.;
+        m_table.Ms[m] = 0.;
+        m_table.gamma[m] = 0.;
+        m_table.exchange[m] = 0.;
+        m_table.anisotropy[m] = 0.;
+    }
+    m_names.push_back("vacuum");
+
+    ParmParse pp;
+
+    // every cell starts as vacuum, including ghost cells at non-periodic boundaries
+    m_id.setVal(0);
+
+    Vector<std::string> materials;
+    pp.queryarr("materials", materials);
+    pp.query("mask_file", m_mask_file);
+
+    if (materials.empty())
+    {
+        if (!m_mask_file.empty()) {
+            amrex::Abort("mask_file: the mask IDs refer to materials, which is not set");
+        }
+
+        // one material in the box mag_lo..mag_hi
+        m_nmat = 1;
+        m_names.push_back("magnet");
+        pp.get("alpha_val", m_table.alpha[1]);
+        pp.get("gamma_val", m_table.gamma[1]);
+        pp.get("Ms_val", m_table.Ms[1]);
+        pp.get("exchange_val", m_table.exchange[1]);
+        pp.get("anisotropy_val", m_table.anisotropy[1]);
+
+        Vector<Real> lo, hi;
+        pp.getarr("mag_lo", lo, 0, AMREX_SPACEDIM);
+        pp.getarr("mag_hi", hi, 0, AMREX_SPACEDIM);
+        paint(1, RealBox(lo.data(), hi.data()), geom);
+    }
+    else
+    {
+        m_nmat = static_cast<int>(materials.size());
+        if (m_nmat >= MaterialTable::max_materials) {
+            amrex::Abort("materials: at most " + std::to_string(MaterialTable::max_materials - 1)
+                         + " materials are supported");
+        }
+
+        for (int m = 1; m <= m_nmat; ++m)
+        {
+            m_names.push_back(materials[m-1]);
+
+            ParmParse pm("material." + materials[m-1]);
+            pm.get("Ms", m_table.Ms[m]);
+            pm.get("alpha", m_table.alpha[m]);
+            pm.get("gamma", m_table.gamma[m]);
+            pm.get("exchange", m_table.exchange[m]);
+            pm.query("anisotropy", m_table.anisotropy[m]);
+
+            if (m_table.Ms[m] <= 0.) {
+                amrex::Abort("material." + materials[m-1] + ".Ms must be > 0; cells outside every region are vacuum");
+            }
+        }
+
+        // the mask goes first, so regions can still be painted on top of it
+        if (!m_mask_file.empty()) readMask(m_mask_file, geom);
+
+        Vector<std::string> regions;
+        if (m_mask_file.empty()) {
+            pp.getarr("regions", regions);
+        } else {
+            pp.queryarr("regions", regions);
+        }
+        for (auto const& region : regions)
+        {
+            ParmParse pr("region." + region);
+
+            std::string material;
+            pr.get("material", material);
+            int m = 0;
+            for (int n = 1; n <= m_nmat; ++n) {
+                if (m_names[n] == material) m = n;
+            }
+            if (m == 0 && material != "vacuum") {
+                amrex::Abort("region." + region + ".material: " + material + " is not in materials");
+            }
+
+            Vector<Real> lo, hi;
+            pr.getarr("lo", lo, 0, AMREX_SPACEDIM);
+            pr.getarr("hi", hi, 0, AMREX_SPACEDIM);
+            paint(m, RealBox(lo.data(), hi.data()), geom);
+        }
+    }
+
+    for (int m = 1; m <= m_nmat; ++m)
+    {
+        Real const Ms2 = m_table.Ms[m] * m_table.Ms[m];
+        m_table.exchange_coeff[m] = 2.0 * m_table.exchange[m] / mu0 / Ms2;
+        m_table.anisotropy_coeff[m] = - 2.0 * m_table.anisotropy[m] / mu0 / Ms2;
+        m_table.precession[m] = mu0 * m_table.gamma[m] / (1._rt + m_table.alpha[m] * m_table.alpha[m]);
+        m_table.damping[m] = m_table.precession[m] * m_table.alpha[m];
+    }
+    for (int m = 0; m < MaterialTable::max_materials; ++m)
+    {
+        if (m > 0 && m <= m_nmat) continue;
+        m_table.exchange_coeff[m] = 0.;
+        m_table.anisotropy_coeff[m] = 0.;
+        m_table.precession[m] = 0.;
+        m_table.damping[m] = 0.;
+    }
+
+    // fill periodic ghost cells
+    m_id.FillBoundary(geom.periodicity());
+}
+
+void Materials::paint (int m, const RealBox& region, const Geometry& geom)
+{
+    GpuArray<Real,AMREX_SPACEDIM> const prob_lo = geom.ProbLoArray();
+    GpuArray<Real,AMREX_SPACEDIM> const dx = geom.CellSizeArray();
+    GpuArray<Real,AMREX_SPACEDIM> const lo = {AMREX_D_DECL(region.lo(0), region.lo(1), region.lo(2))};
+    GpuArray<Real,AMREX_SPACEDIM> const hi = {AMREX_D_DECL(region.hi(0), region.hi(1), region.hi(2))};
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+    for (MFIter mfi(m_id, TilingIfNotGPU()); mfi.isValid(); ++mfi)
+    {
+        // ghost cells inside the domain too, so the ID is also known across the
+        // coarse/fine boundaries of a refined level
+        const Box& bx = mfi.growntilebox() & geom.Domain();
+
+        const Array4<int>& id_arr = m_id.array(mfi);
+
+        amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+        {
+            Real x = prob_lo[0] + (i+0.5) * dx[0];
+            Real y = prob_lo[1] + (j+0.5) * dx[1];
+            Real z = prob_lo[2] + (k+0.5) * dx[2];
+
+            if (x > lo[0] && x < hi[0] && y > lo[1] && y < hi[1] && z > lo[2] && z < hi[2]) {
+                id_arr(i,j,k) = m;
+            }
+        });
+    }
+}
+
+namespace {
+
+struct MaskHeader
+{
+    char magic[8];
+    std::int32_t version;
+    std::int32_t bytes;
+    std::int32_t n[3];
+    std::int32_t unused;
+    double lo[3];
+    double hi[3];
+};
+static_assert(sizeof(MaskHeader) == 80, "the mask header is 80 bytes");
+
+}
+
+void Materials::readMask (const std::string& file, const Geometry& geom)
+{
+    BL_PROFILE("Materials::readMask()");
+
+    Real strt_time = ParallelDescriptor::second();
+
+    int const fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        amrex::Abort("mask_file: cannot open " + file);
+    }
+
+    MaskHeader h;
+    struct stat st;
+    if (::pread(fd, &h, sizeof(h), 0) != static_cast<ssize_t>(sizeof(h)) || ::fstat(fd, &st) != 0) {
+        amrex::Abort("mask_file: cannot read the header of " + file);
+    }
+    if (std::memcmp(h.magic, "MMMASK", 6) != 0 || h.version != 1) {
+        amrex::Abort("mask_file: " + file + " is not a version 1 mask (or not little-endian)");
+    }
+    if (h.bytes != 1 && h.bytes != 2) {
+        amrex::Abort("mask_file: " + file + ": bytes per voxel must be 1 or 2");
+    }
+    if (h.n[0] <= 0 || h.n[1] <= 0 || h.n[2] <= 0) {
+        amrex::Abort("mask_file: " + file + ": bad voxel counts");
+    }
+
+    std::int64_t const nx = h.n[0];
+    std::int64_t const ny = h.n[1];
+    std::int64_t const nz = h.n[2];
+    std::int64_t const plane_bytes = nx * ny * h.bytes;
+    if (static_cast<std::int64_t>(st.st_size) < static_cast<std::int64_t>(sizeof(h)) + nz * plane_bytes) {
+        amrex::Abort("mask_file: " + file + " is shorter than its header says");
+    }
+
+    // physical extent of the mask; lo == hi means the whole domain
+    Real lo[3], hi[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        if (h.hi[d] > h.lo[d]) {
+            lo[d] = h.lo[d];
+            hi[d] = h.hi[d];
+        } else {
+            lo[d] = geom.ProbLo(d);
+            hi[d] = geom.ProbHi(d);
+        }
+    }
+
+    // voxel under the center of cell i in direction d, possibly outside [0, n[d])
+    auto const voxel = [&] (int i, int d) -> std::int64_t
+    {
+        Real const x = geom.ProbLo(d) + (i + 0.5) * geom.CellSize(d);
+        return static_cast<std::int64_t>(std::floor((x - lo[d]) / (hi[d] - lo[d]) * h.n[d]));
+    };
+
+    // z-slab of voxels under the boxes of this rank
+    std::int64_t kz_lo = nz, kz_hi = -1;
+    for (MFIter mfi(m_id); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = amrex::grow(mfi.validbox(), m_id.nGrowVect()) & geom.Domain();
+        std::int64_t const k0 = voxel(bx.smallEnd(2), 2);
+        std::int64_t const k1 = voxel(bx.bigEnd(2), 2);
+        if (k1 < 0 || k0 >= nz) continue;
+        kz_lo = std::min(kz_lo, std::max(k0, std::int64_t(0)));
+        kz_hi = std::max(kz_hi, std::min(k1, nz - 1));
+    }
+
+    if (kz_lo <= kz_hi)
+    {
+        // mmap offsets must be page aligned
+        std::int64_t const page = ::sysconf(_SC_PAGESIZE);
+        std::int64_t const begin = sizeof(h) + kz_lo * plane_bytes;
+        std::int64_t const offset = begin / page * page;
+        std::size_t const length = (kz_hi - kz_lo + 1) * plane_bytes + (begin - offset);
+
+        void* map = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, offset);
+        if (map == MAP_FAILED) {
+            amrex::Abort("mask_file: cannot map " + file);
+        }
+        unsigned char const* slab = static_cast<unsigned char const*>(map) + (begin - offset);
+
+        // prefetch only the rows of voxels under each box; the slab spans every plane
+        // between the boxes of the rank, which can be most of the file
+        for (MFIter mfi(m_id); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = amrex::grow(mfi.validbox(), m_id.nGrowVect()) & geom.Domain();
+            std::int64_t const k0 = std::max(voxel(bx.smallEnd(2), 2), kz_lo);
+            std::int64_t const k1 = std::min(voxel(bx.bigEnd(2), 2), kz_hi);
+            std::int64_t const j0 = std::max(voxel(bx.smallEnd(1), 1), std::int64_t(0));
+            std::int64_t const j1 = std::min(voxel(bx.bigEnd(1), 1), ny - 1);
+            if (k0 > k1 || j0 > j1) continue;
+
+            for (std::int64_t iz = k0; iz <= k1; ++iz)
+            {
+                std::int64_t const row_begin = (begin - offset) + ((iz - kz_lo) * ny + j0) * nx * h.bytes;
+                std::int64_t const row_end = (begin - offset) + ((iz - kz_lo) * ny + j1 + 1) * nx * h.bytes;
+                std::int64_t const advise_begin = row_begin / page * page;
+                ::madvise(static_cast<char*>(map) + advise_begin, row_end - advise_begin, MADV_WILLNEED);
+            }
+        }
+
+        int const nmat = m_nmat;
+        auto const voxel_id = [&] (std::int64_t ix, std::int64_t iy, std::int64_t iz) -> int
+        {
+            std::int64_t const n = (iz - kz_lo) * nx * ny + iy * nx + ix;
+            if (h.bytes == 1) return slab[n];
+            std::uint16_t v;
+            std::memcpy(&v, slab + 2 * n, 2);
+            return v;
+        };
+
+        // valid and ghost cells inside the domain, as in paint
+        for (MFIter mfi(m_id); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = amrex::grow(mfi.validbox(), m_id.nGrowVect()) & geom.Domain();
+            const Dim3 blo = amrex::lbound(bx);
+            const Dim3 len = amrex::length(bx);
+
+            // ID under every cell of the box, -1 outside the mask
+            Vector<int> ids(bx.numPts());
+            bool bad_id = false;
+#ifdef AMREX_USE_OMP
+#pragma omp parallel for reduction(||:bad_id)
+#endif
+            for (int k = 0; k < len.z; ++k)
+            {
+                std::int64_t const iz = voxel(blo.z + k, 2);
+                for (int j = 0; j < len.y; ++j)
+                {
+                    std::int64_t const iy = voxel(blo.y + j, 1);
+                    for (int i = 0; i < len.x; ++i)
+                    {
+                        std::int64_t const ix = voxel(blo.x + i, 0);
+                        int id = -1;
+                        if (ix >= 0 && ix < nx && iy >= 0 && iy < ny && iz >= 0 && iz < nz) {
+                            id = voxel_id(ix, iy, iz);
+                            if (id > nmat) bad_id = true;
+                        }
+                        ids[(static_cast<Long>(k) * len.y + j) * len.x + i] = id;
+                    }
+                }
+            }
+            if (bad_id) {
+                amrex::Abort("mask_file: " + file + " has IDs above the " + std::to_string(nmat) + " materials");
+            }
+
+            Gpu::DeviceVector<int> ids_d(ids.size());
+            Gpu::copy(Gpu::hostToDevice, ids.begin(), ids.end(), ids_d.begin());
+            int const* ids_ptr = ids_d.data();
+
+            const Array4<int>& id_arr = m_id.array(mfi);
+
+            amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+                int const id = ids_ptr[(static_cast<Long>(k - blo.z) * len.y + (j - blo.y)) * len.x + (i - blo.x)];
+                if (id >= 0) id_arr(i,j,k) = id;
+            });
+            Gpu::streamSynchronize();
+        }
+
+        ::munmap(map, length);
+    }
+    ::close(fd);
+
+    m_mask_n = IntVect(AMREX_D_DECL(h.n[0], h.n[1], h.n[2]));
+    m_mask_time = ParallelDescriptor::second() - strt_time;
+    ParallelDescriptor::ReduceRealMax(m_mask_time);
+}
+
+Real Materials::maxMs () const
+{
+    Real Ms_max = 0.;
+    for (int m = 1; m <= m_nmat; ++m) Ms_max = amrex::max(Ms_max, m_table.Ms[m]);
+    return Ms_max;
+}
+
+Vector<Real> Materials::values (const std::string& param) const
+{
+    GpuArray<Real, MaterialTable::max_materials> const* column = nullptr;
+    if (param == "alpha") column = &m_table.alpha;
+    else if (param == "Ms") column = &m_table.Ms;
+    else if (param == "gamma") column = &m_table.gamma;
+    else if (param == "exchange") column = &m_table.exchange;
+    else if (param == "anisotropy") column = &m_table.anisotropy;
+    else if (param != "material") return {};
+
+    Vector<Real> v(m_nmat + 1);
+    for (int m = 0; m <= m_nmat; ++m) v[m] = column ? (*column)[m] : static_cast<Real>(m);
+    return v;
+}
+
+void Materials::checkCouplings (int exchange_coupling, int anisotropy_coupling) const
+{
+    // every magnetic cell takes part in exchange; anisotropy may be absent in soft
+    // layers, but not in the whole sample
+    bool any_anisotropy = false;
+    for (int m = 1; m <= m_nmat; ++m)
+    {
+        if (exchange_coupling == 1 && m_table.exchange[m] == 0.) {
+            amrex::Abort("The exchange constant of material " + m_names[m]
+                         + " is 0.0 while including the exchange coupling term H_exchange for H_eff");
+        }
+        if (m_table.anisotropy[m] != 0.) any_anisotropy = true;
+    }
+    if (anisotropy_coupling == 1 && !any_anisotropy) {
+        amrex::Abort("Every anisotropy constant is 0.0 while including the anisotropy coupling term H_anisotropy for H_eff");
+    }
+}
+
+void Materials::restrictTo (const BoxArray& ba, const DistributionMapping& dm, const Geometry& geom)
+{
+    iMultiFab tmp(ba, dm, 1, m_id.nGrow());
+    tmp.setVal(0);
+    tmp.ParallelCopy(m_id, 0, 0, 1, 0, m_id.nGrow(), geom.periodicity());
+    m_id = std::move(tmp);
+}
+
+void Materials::print () const
+{
+    amrex::Print() << " materials           = " << m_nmat << "\n";
+    if (!m_mask_file.empty()) {
+        amrex::Print() << " mask_file           = " << m_mask_file << " (" << m_mask_n[0] << " x " << m_mask_n[1]
+                       << " x " << m_mask_n[2] << " voxels, read in " << m_mask_time << " s)\n";
+    }
+    for (int m = 1; m <= m_nmat; ++m)
+    {
+        amrex::Print() << "  " << m << " " << m_names[m]
+                       << ": Ms = " << m_table.Ms[m]
+                       << ", alpha = " << m_table.alpha[m]
+                       << ", gamma = " << m_table.gamma[m]
+                       << ", exchange = " << m_table.exchange[m]
+                       << ", anisotropy = " << m_table.anisotropy[m] << "\n";
+    }
+}
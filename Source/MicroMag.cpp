@@ -1,70 +1,6 @@
 #include "MicroMag.H"
 
-
-void InitializeMagneticProperties(MultiFab&  alpha,
-                   MultiFab&   Ms,
-                   MultiFab&   gamma,
-                   MultiFab&   exchange,
-                   MultiFab&   anisotropy,
-                   Real        alpha_val,
-                   Real        Ms_val,
-                   Real        gamma_val,
-                   Real        exchange_val,
-		   Real        anisotropy_val,
-                   amrex::GpuArray<amrex::Real, 3> prob_lo,
-                   amrex::GpuArray<amrex::Real, 3> prob_hi,
-                   amrex::GpuArray<amrex::Real, 3> mag_lo,
-                   amrex::GpuArray<amrex::Real, 3> mag_hi,
-                   const       Geometry& geom)
-{
-
-    alpha.setVal(0.);
-    Ms.setVal(0.);
-    gamma.setVal(0.);
-    exchange.setVal(0.);
-    anisotropy.setVal(0.);
-
-    // loop over boxes
-    for (MFIter mfi(alpha); mfi.isValid(); ++mfi)
-    {
-        const Box& bx = mfi.validbox();
-
-        // extract dx from the geometry object
-        GpuArray<Real,AMREX_SPACEDIM> dx = geom.CellSizeArray();
-        
-        const Array4<Real>& alpha_arr = alpha.array(mfi);
-        const Array4<Real>& gamma_arr = gamma.array(mfi);
-        const Array4<Real>& Ms_arr = Ms.array(mfi);
-        const Array4<Real>& exchange_arr = exchange.array(mfi);
-        const Array4<Real>& anisotropy_arr = anisotropy.array(mfi);
-
-        amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
-        {
-            Real x = prob_lo[0] + (i+0.5) * dx[0];
-            Real y = prob_lo[1] + (j+0.5) * dx[1];
-            Real z = prob_lo[2] + (k+0.5) * dx[2];
-             
-            if (x > mag_lo[0] && x < mag_hi[0]){
-               if (y > mag_lo[1] && y < mag_hi[1]){
-                  if (z > mag_lo[2] && z < mag_hi[2]){
-                     alpha_arr(i,j,k) = alpha_val;
-                     gamma_arr(i,j,k) = gamma_val;
-                     Ms_arr(i,j,k) = Ms_val;
-                     exchange_arr(i,j,k) = exchange_val;
-                     anisotropy_arr(i,j,k) = anisotropy_val;
-                  }
-               }
-            }
-        }); 
-     }
-     // fill periodic ghost cells
-     alpha.FillBoundary(geom.periodicity());
-     Ms.FillBoundary(geom.periodicity());
-     gamma.FillBoundary(geom.periodicity());
-     exchange.FillBoundary(geom.periodicity());
-     anisotropy.FillBoundary(geom.periodicity());
-
-} 
+#include <limits>
 
 /*
 // Compute rho in SC region for given phi
@@ -465,3 +401,157 @@ void SetPhiBC_z(MultiFab& PoissonPhi,
         });
     }
 }
+
+// RHS of -laplacian(Phi) = -div(M), with M taken from cell centers
+void ComputePoissonRHS(MultiFab&                        PoissonRHS,
+                Array<MagMultiFab, AMREX_SPACEDIM>&     Mfield,
+                const Geometry&                         geom)
+{
+    BL_PROFILE("ComputePoissonRHS()");
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+    for (MFIter mfi(PoissonRHS, TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = mfi.tilebox();
+            // extract dx from the geometry object
+            GpuArray<Real,AMREX_SPACEDIM> dx = geom.CellSizeArray();
+
+            const Array4<MagReal const>& Mx = Mfield[0].const_array(mfi);
+            const Array4<MagReal const>& My = Mfield[1].const_array(mfi);
+            const Array4<MagReal const>& Mz = Mfield[2].const_array(mfi);
+            const Array4<Real>& RHS = PoissonRHS.array(mfi);
+
+            amrex::ParallelFor(bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+                // face values are averages of the neighboring cells, so the jump of M
+                // at the magnet surface gives the surface charge
+                RHS(i,j,k) = - (Mx(i+1,j,k) - Mx(i-1,j,k)) / (2.*dx[0])
+                             - (My(i,j+1,k) - My(i,j-1,k)) / (2.*dx[1])
+                             - (Mz(i,j,k+1) - Mz(i,j,k-1)) / (2.*dx[2]);
+            });
+        }
+}
+
+void ComputeHfromPhi(MultiFab&                          PoissonPhi,
+                Array<MagMultiFab, AMREX_SPACEDIM>&     Hfield,
+                amrex::GpuArray<amrex::Real, 3>         prob_lo,
+                amrex::GpuArray<amrex::Real, 3>         prob_hi,
+                const Geometry&                         geom)
+{
+    BL_PROFILE("ComputeHfromPhi()");
+
+       // Calculate H from Phi
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+        for (MFIter mfi(PoissonPhi, TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = mfi.tilebox();
+
+            // extract dx from the geometry object
+            GpuArray<Real,AMREX_SPACEDIM> dx = geom.CellSizeArray();
+
+            const Array4<MagReal>& Hx_arr = Hfield[0].array(mfi);
+            const Array4<MagReal>& Hy_arr = Hfield[1].array(mfi);
+            const Array4<MagReal>& Hz_arr = Hfield[2].array(mfi);
+            const Array4<Real>& phi = PoissonPhi.array(mfi);
+
+            amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+                     Hx_arr(i,j,k) = -(phi(i+1,j,k) - phi(i-1,j,k))/(2.*dx[0]);
+                     Hy_arr(i,j,k) = -(phi(i,j+1,k) - phi(i,j-1,k))/(2.*dx[1]);
+
+                     Real z_hi = prob_lo[2] + (k+1.5) * dx[2];
+                     Real z_lo = prob_lo[2] + (k-0.5) * dx[2];
+
+                     if(z_lo < prob_lo[2]){ //Bottom Boundary
+                       Hz_arr(i,j,k) = -(phi(i,j,k+1) - phi(i,j,k))/(dx[2]);
+                     } else if (z_hi > prob_hi[2]){ //Top Boundary
+                       Hz_arr(i,j,k) = -(phi(i,j,k) - phi(i,j,k-1))/(dx[2]);
+                     } else{ //inside
+                       Hz_arr(i,j,k) = -(phi(i,j,k+1) - phi(i,j,k-1))/(2.*dx[2]);
+                     }
+             });
+        }
+
+}
+
+// max over cells and components of |M - M_old|
+Real MaxMagnetizationChange(Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                Array<MagMultiFab, AMREX_SPACEDIM>&     Mfield_old)
+{
+    BL_PROFILE("MaxMagnetizationChange()");
+
+    ReduceOps<ReduceOpMax> reduce_op;
+    ReduceData<Real> reduce_data(reduce_op);
+    using ReduceTuple = typename decltype(reduce_data)::Type;
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+    for (MFIter mfi(Mfield[0], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.tilebox();
+
+        const Array4<MagReal const>& Mx = Mfield[0].const_array(mfi);
+        const Array4<MagReal const>& My = Mfield[1].const_array(mfi);
+        const Array4<MagReal const>& Mz = Mfield[2].const_array(mfi);
+        const Array4<MagReal const>& Mx_old = Mfield_old[0].const_array(mfi);
+        const Array4<MagReal const>& My_old = Mfield_old[1].const_array(mfi);
+        const Array4<MagReal const>& Mz_old = Mfield_old[2].const_array(mfi);
+
+        reduce_op.eval(bx, reduce_data, [=] AMREX_GPU_DEVICE (int i, int j, int k) -> ReduceTuple
+        {
+            return {amrex::max(amrex::Math::abs(Real(Mx(i,j,k)) - Real(Mx_old(i,j,k))),
+                               amrex::Math::abs(Real(My(i,j,k)) - Real(My_old(i,j,k))),
+                               amrex::Math::abs(Real(Mz(i,j,k)) - Real(Mz_old(i,j,k))))};
+        });
+    }
+
+    Real dM = amrex::get<0>(reduce_data.value(reduce_op));
+    ParallelDescriptor::ReduceRealMax(dM);
+    return dM;
+}
+
+// Boxes covering the magnetic cells (material ID > 0): each box of the ID field is
+// shrunk to the bounding box of its magnetic cells, and boxes without any are dropped
+BoxArray MagneticBoxArray(const iMultiFab&              material_id)
+{
+    Vector<Box> mag_boxes;
+
+    int const imax = std::numeric_limits<int>::max();
+    int const imin = std::numeric_limits<int>::lowest();
+
+    for (MFIter mfi(material_id); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.validbox();
+
+        const Array4<int const>& id_arr = material_id.const_array(mfi);
+
+        ReduceOps<ReduceOpMin, ReduceOpMin, ReduceOpMin, ReduceOpMax, ReduceOpMax, ReduceOpMax> reduce_op;
+        ReduceData<int, int, int, int, int, int> reduce_data(reduce_op);
+        using ReduceTuple = typename decltype(reduce_data)::Type;
+
+        reduce_op.eval(bx, reduce_data, [=] AMREX_GPU_DEVICE (int i, int j, int k) -> ReduceTuple
+        {
+            if (id_arr(i,j,k) > 0) return {i, j, k, i, j, k};
+            return {imax, imax, imax, imin, imin, imin};
+        });
+
+        ReduceTuple hv = reduce_data.value(reduce_op);
+        if (amrex::get<0>(hv) <= amrex::get<3>(hv))
+        {
+            mag_boxes.push_back(Box(IntVect(AMREX_D_DECL(amrex::get<0>(hv), amrex::get<1>(hv), amrex::get<2>(hv))),
+                                    IntVect(AMREX_D_DECL(amrex::get<3>(hv), amrex::get<4>(hv), amrex::get<5>(hv)))));
+        }
+    }
+
+    amrex::AllGatherBoxes(mag_boxes);
+
+    if (mag_boxes.empty()) amrex::Abort("sparse_execution = 1 but no cell holds a magnetic material");
+
+    return BoxArray(BoxList(std::move(mag_boxes)));
+}
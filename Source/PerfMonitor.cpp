@@ -0,0 +1,126 @@
+#include "PerfMonitor.H"
+
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+static const char* phase_names[PerfMonitor::NumPhases] =
+    {"field_assembly", "update", "normalize", "halo_exchange", "demag", "io"};
+
+PerfMonitor::PerfMonitor (const BoxArray& ba, const DistributionMapping& dm, bool measure_bandwidth)
+    : m_cells(static_cast<Real>(ba.numPts()))
+{
+    if (!measure_bandwidth) return;
+
+    BL_PROFILE("PerfMonitor::bandwidth");
+
+    // c = a + 0.5 b over three 3-component arrays: two reads and one write per value
+    MultiFab a(ba, dm, AMREX_SPACEDIM, 0);
+    MultiFab b(ba, dm, AMREX_SPACEDIM, 0);
+    MultiFab c(ba, dm, AMREX_SPACEDIM, 0);
+    a.setVal(1.);
+    b.setVal(2.);
+    c.setVal(0.);
+
+    int const nrepeat = 10;
+    MultiFab::LinComb(c, 1., a, 0, 0.5, b, 0, 0, AMREX_SPACEDIM, 0);
+
+    ParallelDescriptor::Barrier();
+    Real strt_time = ParallelDescriptor::second();
+    for (int n = 0; n < nrepeat; n++)
+    {
+        MultiFab::LinComb(c, 1., a, 0, 0.5, b, 0, 0, AMREX_SPACEDIM, 0);
+    }
+    Gpu::streamSynchronize();
+    Real triad_time = (ParallelDescriptor::second() - strt_time) / nrepeat;
+    ParallelDescriptor::ReduceRealMax(triad_time);
+
+    m_bandwidth = 3. * AMREX_SPACEDIM * sizeof(Real) * m_cells / triad_time;
+
+    amrex::Print() << "Measured memory bandwidth " << m_bandwidth / 1.e9 << " GB/s\n";
+}
+
+PerfMonitor::Timer::Timer (PerfMonitor& perf, Phase phase, Real bytes)
+    : m_perf(perf), m_phase(phase), m_bytes(bytes),
+      m_strt_time(ParallelDescriptor::second()), m_outer_child_time(perf.m_child_time)
+{
+    m_perf.m_child_time = 0.;
+}
+
+PerfMonitor::Timer::~Timer ()
+{
+    Real const elapsed = ParallelDescriptor::second() - m_strt_time;
+    m_perf.m_time[m_phase] += elapsed - m_perf.m_child_time;
+    m_perf.m_bytes[m_phase] += m_bytes;
+    ++m_perf.m_calls[m_phase];
+    m_perf.m_child_time = m_outer_child_time + elapsed;
+}
+
+// peak resident set size of this process in MB, 0 where unavailable
+static Real PeakRSSMegabytes ()
+{
+#if defined(__APPLE__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<Real>(usage.ru_maxrss) / 1048576.;
+#elif defined(__unix__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<Real>(usage.ru_maxrss) / 1024.;
+#else
+    return 0.;
+#endif
+}
+
+void PerfMonitor::writeJSON (const std::string& file, int step) const
+{
+    // the slowest rank sets each phase's time
+    Real time[NumPhases];
+    for (int p = 0; p < NumPhases; ++p) time[p] = m_time[p];
+    Real loop_time = m_loop_time;
+    ParallelDescriptor::ReduceRealMax(time, NumPhases);
+    ParallelDescriptor::ReduceRealMax(loop_time);
+
+    // high-water marks of the busiest rank
+    Real peak_fab_MB = static_cast<Real>(amrex::TotalBytesAllocatedInFabsHWM()) / 1048576.;
+    Real peak_rss_MB = PeakRSSMegabytes();
+    ParallelDescriptor::ReduceRealMax(peak_fab_MB);
+    ParallelDescriptor::ReduceRealMax(peak_rss_MB);
+
+    if (!ParallelDescriptor::IOProcessor()) return;
+
+    std::ofstream ofs(file, std::ofstream::out | std::ofstream::trunc);
+    if (!ofs.good()) amrex::FileOpenFailed(file);
+    ofs.precision(8);
+
+    ofs << "{\n"
+        << "  \"step\": " << step << ",\n"
+        << "  \"ranks\": " << ParallelDescriptor::NProcs() << ",\n"
+        << "  \"cells\": " << static_cast<long>(m_cells) << ",\n"
+        << "  \"steps\": " << m_steps << ",\n"
+        << "  \"loop_time\": " << loop_time << ",\n"
+        << "  \"cell_updates_per_second\": " << ((loop_time > 0.) ? m_cells * m_steps / loop_time : 0.) << ",\n"
+        << "  \"memory_bandwidth_GBps\": " << m_bandwidth / 1.e9 << ",\n"
+        << "  \"peak_fab_MB\": " << peak_fab_MB << ",\n"
+        << "  \"peak_rss_MB\": " << peak_rss_MB << ",\n"
+        << "  \"phases\": {\n";
+    for (int p = 0; p < NumPhases; ++p)
+    {
+        ofs << "    \"" << phase_names[p] << "\": {"
+            << "\"calls\": " << m_calls[p]
+            << ", \"time\": " << time[p]
+            << ", \"fraction_of_loop\": " << ((loop_time > 0.) ? time[p] / loop_time : 0.);
+        // phases without a traffic estimate have no bandwidth figures
+        if (m_bytes[p] > 0. && time[p] > 0.) {
+            Real const rate = m_bytes[p] / time[p];
+            ofs << ", \"bytes\": " << m_bytes[p]
+                << ", \"GBps\": " << rate / 1.e9;
+            if (m_bandwidth > 0.) ofs << ", \"fraction_of_bandwidth\": " << rate / m_bandwidth;
+        }
+        ofs << "}" << ((p + 1 < NumPhases) ? "," : "") << "\n";
+    }
+    ofs << "  }\n"
+        << "}\n";
+}
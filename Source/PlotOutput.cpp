@@ -0,0 +1,144 @@
+#include "PlotOutput.H"
+
+#include <AMReX_PlotFileUtil.H>
+
+#include <algorithm>
+#include <utility>
+
+PlotOutput::PlotOutput (const Geometry& geom, const BoxArray& ba, const DistributionMapping& dm,
+                        const Vector<std::string>& plot_vars)
+    : m_geom(geom), m_ba(ba), m_dm(dm), m_plot_vars(plot_vars)
+{}
+
+bool PlotOutput::selected (const std::string& name) const
+{
+    return std::find(m_plot_vars.begin(), m_plot_vars.end(), name) != m_plot_vars.end();
+}
+
+void PlotOutput::addStatic (const std::string& name, const MultiFab& mf)
+{
+    if (selected(name)) m_fields.push_back({name, &mf, 0., true});
+}
+
+void PlotOutput::addStatic (const std::string& name, Real value)
+{
+    if (selected(name)) m_fields.push_back({name, nullptr, value, true});
+}
+
+void PlotOutput::addStatic (const std::string& name, const iMultiFab& id, const Vector<Real>& values)
+{
+    if (selected(name)) m_fields.push_back({name, nullptr, 0., true, nullptr, &id, values});
+}
+
+void PlotOutput::addDynamic (const std::string& name, const MultiFab& mf)
+{
+    if (selected(name)) m_fields.push_back({name, &mf, 0., false});
+}
+
+void PlotOutput::addDynamic (const std::string& name, std::function<void (MultiFab&, int, Real)> fill)
+{
+    if (selected(name)) m_fields.push_back({name, nullptr, 0., false, nullptr, nullptr, {}, std::move(fill)});
+}
+
+#ifdef MICROMAG_MIXED_PRECISION
+void PlotOutput::addDynamic (const std::string& name, const MagMultiFab& mf)
+{
+    if (selected(name)) m_fields.push_back({name, nullptr, 0., false, &mf});
+}
+#endif
+
+void PlotOutput::checkSelection () const
+{
+    for (auto const& var : m_plot_vars)
+    {
+        bool found = false;
+        for (auto const& f : m_fields) {
+            if (f.name == var) found = true;
+        }
+        if (!found) amrex::Abort("plot_vars: " + var + " is not an available plot variable in this run");
+    }
+}
+
+// values[id] on the layout of id
+static MultiFab LookupValues (const iMultiFab& id, const Vector<Real>& values)
+{
+    MultiFab mf(id.boxArray(), id.DistributionMap(), 1, 0);
+
+    Gpu::DeviceVector<Real> values_d(values.size());
+    Gpu::copy(Gpu::hostToDevice, values.begin(), values.end(), values_d.begin());
+    Real const* table = values_d.data();
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+    for (MFIter mfi(mf, TilingIfNotGPU()); mfi.isValid(); ++mfi)
+    {
+        const Box& bx = mfi.tilebox();
+
+        const Array4<Real>& v = mf.array(mfi);
+        const Array4<int const>& id_arr = id.const_array(mfi);
+
+        amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+        {
+            v(i,j,k) = table[id_arr(i,j,k)];
+        });
+    }
+    Gpu::streamSynchronize();
+    return mf;
+}
+
+void PlotOutput::write (int step, Real time, const std::string& prefix)
+{
+    BL_PROFILE("PlotOutput::write()");
+
+    Real strt_time = ParallelDescriptor::second();
+
+    bool const with_static = !m_static_written;
+
+    Vector<std::string> names;
+    for (auto const& f : m_fields) {
+        if (with_static || !f.is_static) names.push_back(f.name);
+    }
+    if (names.empty()) return;
+
+    // the first plotfile has its own buffer, so the staging buffer only ever holds
+    // the time-dependent fields
+    MultiFab first;
+    MultiFab* plt = &m_stage;
+    // cells outside the (possibly sparse) boxes of the fields stay zero
+    if (with_static) {
+        first.define(m_ba, m_dm, static_cast<int>(names.size()), 0);
+        first.setVal(0.);
+        plt = &first;
+    } else if (!m_stage.ok()) {
+        m_stage.define(m_ba, m_dm, static_cast<int>(names.size()), 0);
+        m_stage.setVal(0.);
+    }
+
+    int comp = 0;
+    for (auto const& f : m_fields)
+    {
+        if (!with_static && f.is_static) continue;
+        if (f.mf) {
+            plt->ParallelCopy(*f.mf, 0, comp, 1);
+        } else if (f.mag) {
+            plt->ParallelCopy(RealView(*f.mag, m_convert), 0, comp, 1);
+        } else if (f.id) {
+            plt->ParallelCopy(LookupValues(*f.id, f.table), 0, comp, 1);
+        } else if (f.fill) {
+            f.fill(*plt, comp, time);
+        } else {
+            plt->setVal(f.value, comp, 1, 0);
+        }
+        ++comp;
+    }
+
+    const std::string& pltfile = amrex::Concatenate(prefix,step,8);
+    WriteSingleLevelPlotfile(pltfile, *plt, names, m_geom, time, step);
+
+    m_static_written = true;
+
+    Real write_time = ParallelDescriptor::second() - strt_time;
+    ParallelDescriptor::ReduceRealMax(write_time);
+    m_write_time += write_time;
+}
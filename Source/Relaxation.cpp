@@ -0,0 +1,150 @@
+#include "Relaxation.H"
+
+#include <utility>
+
+Relaxation::Relaxation (const BoxArray& ba, const DistributionMapping& dm, Real tol, int maxiter)
+    : m_tol(tol), m_maxiter(maxiter)
+{
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+        m_G[dir].define(ba, dm, 1, 0);
+        m_G_prev[dir].define(ba, dm, 1, 0);
+        m_M_prev[dir].define(ba, dm, 1, 0);
+    }
+}
+
+int Relaxation::Relax (Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                       const Materials& materials,
+                       const DirectionFunction& direction)
+{
+    BL_PROFILE("Relaxation::Relax()");
+
+    m_converged = false;
+
+    Real const Ms_max = materials.maxMs();
+
+    int iter = 0;
+    for ( ; ; ++iter)
+    {
+        direction(Mfield, m_G);
+
+        // max |G|, and for the BB steps s.s, s.y and y.y with s = m - m_prev, y = G - G_prev
+        bool const have_prev = (iter > 0);
+
+        ReduceOps<ReduceOpMax, ReduceOpSum, ReduceOpSum, ReduceOpSum> reduce_op;
+        ReduceData<Real, Real, Real, Real> reduce_data(reduce_op);
+        using ReduceTuple = typename decltype(reduce_data)::Type;
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+        for (MFIter mfi(Mfield[0], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = mfi.tilebox();
+
+            Array4<MagReal const> const &Mx = Mfield[0].const_array(mfi);
+            Array4<MagReal const> const &My = Mfield[1].const_array(mfi);
+            Array4<MagReal const> const &Mz = Mfield[2].const_array(mfi);
+            Array4<MagReal const> const &Mx_prev = m_M_prev[0].const_array(mfi);
+            Array4<MagReal const> const &My_prev = m_M_prev[1].const_array(mfi);
+            Array4<MagReal const> const &Mz_prev = m_M_prev[2].const_array(mfi);
+            Array4<MagReal const> const &Gx = m_G[0].const_array(mfi);
+            Array4<MagReal const> const &Gy = m_G[1].const_array(mfi);
+            Array4<MagReal const> const &Gz = m_G[2].const_array(mfi);
+            Array4<MagReal const> const &Gx_prev = m_G_prev[0].const_array(mfi);
+            Array4<MagReal const> const &Gy_prev = m_G_prev[1].const_array(mfi);
+            Array4<MagReal const> const &Gz_prev = m_G_prev[2].const_array(mfi);
+
+            const Array4<int const>& id_arr = materials.id().const_array(mfi);
+            MaterialTable const mat = materials.table();
+
+            reduce_op.eval(bx, reduce_data,
+            [=] AMREX_GPU_DEVICE (int i, int j, int k) -> ReduceTuple
+            {
+                int const m = id_arr(i,j,k);
+                if (m == 0) return {0., 0., 0., 0.};
+
+                Real const G_mag = std::sqrt(Gx(i,j,k)*Gx(i,j,k) + Gy(i,j,k)*Gy(i,j,k) + Gz(i,j,k)*Gz(i,j,k));
+                if (!have_prev) return {G_mag, 0., 0., 0.};
+
+                Real const inv_Ms = 1._rt / mat.Ms[m];
+                Real const sx = (Real(Mx(i,j,k)) - Real(Mx_prev(i,j,k))) * inv_Ms;
+                Real const sy = (Real(My(i,j,k)) - Real(My_prev(i,j,k))) * inv_Ms;
+                Real const sz = (Real(Mz(i,j,k)) - Real(Mz_prev(i,j,k))) * inv_Ms;
+                Real const yx = Real(Gx(i,j,k)) - Real(Gx_prev(i,j,k));
+                Real const yy = Real(Gy(i,j,k)) - Real(Gy_prev(i,j,k));
+                Real const yz = Real(Gz(i,j,k)) - Real(Gz_prev(i,j,k));
+
+                return {G_mag, sx*sx + sy*sy + sz*sz, sx*yx + sy*yy + sz*yz, yx*yx + yy*yy + yz*yz};
+            });
+        }
+
+        ReduceTuple hv = reduce_data.value(reduce_op);
+        Real max_G = amrex::get<0>(hv);
+        Real dots[3] = {amrex::get<1>(hv), amrex::get<2>(hv), amrex::get<3>(hv)};
+        ParallelDescriptor::ReduceRealMax(max_G);
+        ParallelDescriptor::ReduceRealSum(dots, 3);
+
+        m_max_torque = max_G;
+        if (max_G < m_tol * Ms_max) {
+            m_converged = true;
+            break;
+        }
+        if (iter == m_maxiter) break;
+
+        // alternate BB1 and BB2; fall back to the rotation limit where the energy is
+        // not locally convex along the last step
+        Real const tau_max = max_angle / max_G;
+        Real tau = tau_max;
+        if (have_prev && dots[1] > 0.) {
+            tau = (iter % 2 == 1) ? dots[0] / dots[1] : dots[1] / dots[2];
+        }
+        tau = amrex::min(tau, tau_max);
+
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+        for (MFIter mfi(Mfield[0], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = mfi.tilebox();
+
+            Array4<MagReal> const &Mx = Mfield[0].array(mfi);
+            Array4<MagReal> const &My = Mfield[1].array(mfi);
+            Array4<MagReal> const &Mz = Mfield[2].array(mfi);
+            Array4<MagReal> const &Mx_prev = m_M_prev[0].array(mfi);
+            Array4<MagReal> const &My_prev = m_M_prev[1].array(mfi);
+            Array4<MagReal> const &Mz_prev = m_M_prev[2].array(mfi);
+            Array4<MagReal const> const &Gx = m_G[0].const_array(mfi);
+            Array4<MagReal const> const &Gy = m_G[1].const_array(mfi);
+            Array4<MagReal const> const &Gz = m_G[2].const_array(mfi);
+
+            const Array4<int const>& id_arr = materials.id().const_array(mfi);
+            MaterialTable const mat = materials.table();
+
+            amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
+            {
+                Mx_prev(i,j,k) = Mx(i,j,k);
+                My_prev(i,j,k) = My(i,j,k);
+                Mz_prev(i,j,k) = Mz(i,j,k);
+
+                int const m = id_arr(i,j,k);
+                if (m > 0)
+                {
+                    // G is tangent to M, so |M - tau Ms G| >= |M| > 0
+                    Real const Ms = mat.Ms[m];
+                    Real const vx = Mx(i,j,k) - tau * Ms * Gx(i,j,k);
+                    Real const vy = My(i,j,k) - tau * Ms * Gy(i,j,k);
+                    Real const vz = Mz(i,j,k) - tau * Ms * Gz(i,j,k);
+                    Real const scale = Ms / std::sqrt(vx*vx + vy*vy + vz*vz);
+                    Mx(i,j,k) = vx * scale;
+                    My(i,j,k) = vy * scale;
+                    Mz(i,j,k) = vz * scale;
+                }
+            });
+        }
+
+        std::swap(m_G, m_G_prev);
+    }
+
+    return iter;
+}
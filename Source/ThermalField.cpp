@@ -0,0 +1,55 @@
+#include "ThermalField.H"
+
+#include <AMReX_ParmParse.H>
+
+#include <cmath>
+
+ThermalField::ThermalField (const Materials& materials, const Geometry& geom, Real mu0)
+{
+    ParmParse pp;
+    pp.query("temperature", temperature);
+    long long seed_in = 0;
+    pp.query("thermal_seed", seed_in);
+    seed = static_cast<std::uint64_t>(seed_in);
+
+    if (temperature < 0.) {
+        amrex::Abort("temperature must be >= 0");
+    }
+
+    const Box& domain = geom.Domain();
+    for (int d = 0; d < 3; ++d)
+    {
+        dom_lo[d] = domain.smallEnd(d);
+        dom_len[d] = domain.length(d);
+    }
+
+    constexpr Real kB = 1.380649e-23;
+    GpuArray<Real,AMREX_SPACEDIM> const dx = geom.CellSizeArray();
+    Real const dV = dx[0] * dx[1] * dx[2];
+
+    MaterialTable const& mat = materials.table();
+    for (int m = 0; m < MaterialTable::max_materials; ++m)
+    {
+        coeff[m] = 0.;
+        sigma[m] = 0.;
+    }
+    for (int m = 1; m <= materials.numMaterials(); ++m)
+    {
+        coeff[m] = 2. * mat.alpha[m] * kB / (mu0 * mu0 * std::abs(mat.gamma[m]) * mat.Ms[m] * dV);
+    }
+}
+
+void ThermalField::setStep (int a_step, Real dt)
+{
+    step = static_cast<std::uint32_t>(a_step);
+    for (int m = 0; m < MaterialTable::max_materials; ++m)
+    {
+        sigma[m] = std::sqrt(coeff[m] * temperature / dt);
+    }
+}
+
+void ThermalField::print () const
+{
+    if (!enabled()) return;
+    amrex::Print() << " temperature         = " << temperature << " K, thermal_seed = " << seed << "\n";
+}
@@ -0,0 +1,258 @@
+#include "TimeIntegrator.H"
+
+#include <cmath>
+#include <complex>
+
+// Butcher tableaux; e holds the weights of the embedded error estimate (b - b*)
+struct ButcherTableau
+{
+    int nstages;
+    Real a[7][7];
+    Real b[7];
+    Real e[7];
+};
+
+static const ButcherTableau& GetTableau (int order)
+{
+    static const ButcherTableau euler = {1, {{0.}}, {1.}, {0.}};
+
+    static const ButcherTableau heun = {2,
+        {{0.},
+         {1.}},
+        {0.5, 0.5}, {0.}};
+
+    static const ButcherTableau rk4 = {4,
+        {{0.},
+         {0.5},
+         {0., 0.5},
+         {0., 0., 1.}},
+        {1./6., 1./3., 1./3., 1./6.}, {0.}};
+
+    static const ButcherTableau dormand_prince = {7,
+        {{0.},
+         {1./5.},
+         {3./40., 9./40.},
+         {44./45., -56./15., 32./9.},
+         {19372./6561., -25360./2187., 64448./6561., -212./729.},
+         {9017./3168., -355./33., 46732./5247., 49./176., -5103./18656.},
+         {35./384., 0., 500./1113., 125./192., -2187./6784., 11./84.}},
+        {35./384., 0., 500./1113., 125./192., -2187./6784., 11./84., 0.},
+        {71./57600., 0., -71./16695., 71./1920., -17253./339200., 22./525., -1./40.}};
+
+    if (order == 1) return euler;
+    if (order == 2) return heun;
+    if (order == 4) return rk4;
+    return dormand_prince;
+}
+
+TimeIntegrator::TimeIntegrator (int order, const BoxArray& ba, const DistributionMapping& dm, int nghost)
+    : m_order(order)
+{
+    if (order != 1 && order != 2 && order != 4 && order != 5) {
+        amrex::Abort("TimeIntegratorOrder must be 1 (Euler), 2 (RK2), 4 (RK4) or 5 (adaptive RK45)");
+    }
+
+    const int nstages = GetTableau(order).nstages;
+
+    m_k.resize(nstages);
+    for (int s = 0; s < nstages; s++)
+    {
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            m_k[s][dir].define(ba, dm, 1, 0);
+        }
+    }
+
+    if (nstages > 1)
+    {
+        m_stage_storage.define(ba, dm, AMREX_SPACEDIM, nghost);
+        m_stage_storage.setVal(0.);
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            m_stage[dir] = MagMultiFab(m_stage_storage, amrex::make_alias, dir, 1);
+        }
+    }
+}
+
+void TimeIntegrator::Combine (Array<MagMultiFab, AMREX_SPACEDIM>& dst, Array<MagMultiFab, AMREX_SPACEDIM>& src,
+                              Real dt, int nstages, const Real* c)
+{
+    // slopes with a nonzero weight; the sum is formed in Real and rounded once to the
+    // storage type
+    int nterms = 0;
+    GpuArray<int, 7> terms;
+    GpuArray<Real, 7> w;
+    for (int s = 0; s < nstages; s++)
+    {
+        if (c[s] != 0.) {
+            terms[nterms] = s;
+            w[nterms] = dt * c[s];
+            ++nterms;
+        }
+    }
+
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+        for (MFIter mfi(dst[dir], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = mfi.tilebox();
+
+            Array4<MagReal> const& d = dst[dir].array(mfi);
+            Array4<MagReal const> const& m = src[dir].const_array(mfi);
+            GpuArray<Array4<MagReal const>, 7> k;
+            for (int n = 0; n < nterms; n++) k[n] = m_k[terms[n]][dir].const_array(mfi);
+
+            amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int kk)
+            {
+                Real sum = m(i,j,kk);
+                for (int n = 0; n < nterms; n++) sum += w[n] * k[n](i,j,kk);
+                d(i,j,kk) = static_cast<MagReal>(sum);
+            });
+        }
+    }
+}
+
+Real TimeIntegrator::ErrorNorm (Real dt, int nstages, const Real* e)
+{
+    int nterms = 0;
+    GpuArray<int, 7> terms;
+    GpuArray<Real, 7> w;
+    for (int s = 0; s < nstages; s++)
+    {
+        if (e[s] != 0.) {
+            terms[nterms] = s;
+            w[nterms] = dt * e[s];
+            ++nterms;
+        }
+    }
+
+    ReduceOps<ReduceOpMax> reduce_op;
+    ReduceData<Real> reduce_data(reduce_op);
+    using ReduceTuple = typename decltype(reduce_data)::Type;
+
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    {
+#ifdef AMREX_USE_OMP
+#pragma omp parallel if (Gpu::notInLaunchRegion())
+#endif
+        for (MFIter mfi(m_k[0][dir], TilingIfNotGPU()); mfi.isValid(); ++mfi)
+        {
+            const Box& bx = mfi.tilebox();
+
+            GpuArray<Array4<MagReal const>, 7> k;
+            for (int n = 0; n < nterms; n++) k[n] = m_k[terms[n]][dir].const_array(mfi);
+
+            reduce_op.eval(bx, reduce_data, [=] AMREX_GPU_DEVICE (int i, int j, int kk) -> ReduceTuple
+            {
+                Real err = 0.;
+                for (int n = 0; n < nterms; n++) err += w[n] * k[n](i,j,kk);
+                return {amrex::Math::abs(err)};
+            });
+        }
+    }
+
+    Real err = amrex::get<0>(reduce_data.value(reduce_op));
+    ParallelDescriptor::ReduceRealMax(err);
+    return err;
+}
+
+Real TimeIntegrator::Advance (Array<MagMultiFab, AMREX_SPACEDIM>& Mfield,
+                              Array<MagMultiFab, AMREX_SPACEDIM>& Mfield_old,
+                              const RHSFunction& rhs,
+                              Real time,
+                              Real& dt)
+{
+    BL_PROFILE("TimeIntegrator::Advance()");
+
+    const ButcherTableau& tab = GetTableau(m_order);
+
+    Real dt_try = amrex::min(dt, m_dt_max);
+
+    // the first slope does not depend on the step size, so it survives rejected steps
+    rhs(Mfield_old, m_k[0], time);
+
+    while (true)
+    {
+        for (int s = 1; s < tab.nstages; s++)
+        {
+            Combine(m_stage, Mfield_old, dt_try, s, tab.a[s]);
+            // stage time t + c_s dt, with c_s the row sum of a
+            Real c = 0.;
+            for (int n = 0; n < s; n++) c += tab.a[s][n];
+            rhs(m_stage, m_k[s], time + c * dt_try);
+        }
+
+        if (isAdaptive())
+        {
+            Real err = ErrorNorm(dt_try, tab.nstages, tab.e) / (m_rtol * m_Ms_scale);
+
+            // standard controller for a 5th-order solution with a 4th-order error estimate
+            Real fac = (err > 0.) ? 0.9 * std::pow(err, -0.2) : 5.;
+            fac = amrex::min(5., amrex::max(0.2, fac));
+
+            if (err > 1.)
+            {
+                ++m_nrejected;
+                dt_try *= fac;
+                if (dt_try < 1.e-30) amrex::Abort("Adaptive time step underflow");
+                continue;
+            }
+
+            dt = amrex::min(dt_try * fac, m_dt_max);
+        }
+
+        break;
+    }
+
+    Combine(Mfield, Mfield_old, dt_try, tab.nstages, tab.b);
+
+    return dt_try;
+}
+
+Real TimeIntegrator::StabilityRadius (int order, Real theta)
+{
+    // stability polynomials R(z) of the schemes above
+    Vector<Real> coef;
+    if (order == 1) {
+        coef = {1., 1.};
+    } else if (order == 2) {
+        coef = {1., 1., 1./2.};
+    } else if (order == 4) {
+        coef = {1., 1., 1./2., 1./6., 1./24.};
+    } else {
+        coef = {1., 1., 1./2., 1./6., 1./24., 1./120., 1./600.};
+    }
+
+    Real const dr = 1.e-3;
+    Real r = 0.;
+    while (r < 10.)
+    {
+        std::complex<Real> const z = std::polar(r + dr, theta);
+        std::complex<Real> R = 0.;
+        std::complex<Real> zn = 1.;
+        for (Real c : coef) {
+            R += c * zn;
+            zn *= z;
+        }
+        if (std::abs(R) > 1.) break;
+        r += dr;
+    }
+    return r;
+}
+
+Real ExchangeStableDt (int order, Real alpha, Real gamma, Real Ms, Real exchange,
+                       const GpuArray<Real,AMREX_SPACEDIM>& dx)
+{
+    Real k2 = 0.;
+    for (int dir = 0; dir < AMREX_SPACEDIM; dir++) {
+        k2 += 4. / (dx[dir] * dx[dir]);
+    }
+
+    Real const lambda = std::abs(gamma) / std::sqrt(1. + alpha*alpha) * 2. * exchange / Ms * k2;
+    Real const theta = std::atan2(1., -alpha);
+
+    return TimeIntegrator::StabilityRadius(order, theta) / lambda;
+}
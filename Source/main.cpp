@@ -7,17 +7,74 @@
 #include <AMReX_VisMF.H>
 #include "myfunc.H"
 #include "MicroMag.H"
-#include "MagLaplacian.H"
+#include "Demagnetization.H"
+#include "EvolveM.H"
+#include "TimeIntegrator.H"
+#include "ImplicitExchange.H"
+#include "ExchangeStencil.H"
+#include "HaloExchange.H"
+#include "PlotOutput.H"
+#include "Checkpoint.H"
+#include "Diagnostics.H"
+#include "Relaxation.H"
+#include "Materials.H"
+#include "AppliedField.H"
+#include "FieldSweep.H"
+#include "Ensemble.H"
+#include "ThermalField.H"
+#include "AmrMicroMag.H"
+#include "PerfMonitor.H"
+
+#include <limits>
+#include <utility>
 
 using namespace amrex;
 
 int main (int argc, char* argv[])
 {
+    // MPI outlives the AMReX instances, so that an ensemble can start one per member
+#ifdef AMREX_USE_MPI
+#ifdef AMREX_MPI_THREAD_MULTIPLE
+    int const requested = MPI_THREAD_MULTIPLE;
+#else
+    int const requested = MPI_THREAD_FUNNELED;
+#endif
+    int provided;
+    MPI_Init_thread(&argc, &argv, requested, &provided);
+#endif
+
     amrex::Initialize(argc,argv);
 
-    main_main();
+    Ensemble ensemble;
+    if (ensemble.numMembers() > 1)
+    {
+        double const ensemble_strt_time = ParallelDescriptor::second();
+        amrex::Finalize();
+
+        // each member runs in its own AMReX instance on the communicator of its group
+        for (int member : ensemble.members())
+        {
+            amrex::Initialize(argc, argv, true, ensemble.communicator());
+            ensemble.begin(member);
+
+            main_main();
 
-    amrex::Finalize();
+            ensemble.end();
+            amrex::Finalize();
+        }
+
+        ensemble.finish(ParallelDescriptor::second() - ensemble_strt_time);
+    }
+    else
+    {
+        main_main();
+
+        amrex::Finalize();
+    }
+
+#ifdef AMREX_USE_MPI
+    MPI_Finalize();
+#endif
     return 0;
 }
 
@@ -40,27 +97,76 @@ void main_main ()
     // how often to write a plotfile
     int plot_int;
 
+    // how often to write a checkpoint, the number of ranks writing at once, whether
+    // to include PoissonPhi, and the checkpoint to restart from (empty = start at t = 0)
+    int chk_int;
+    int chk_nfiles;
+    int chk_poisson_phi;
+    std::string restart_chkfile;
+
+    // how often to append to the diagnostics time series, and its file name
+    int diag_int;
+    std::string diag_file;
+
+    // variables written to the plotfiles
+    amrex::Vector<std::string> plot_vars;
+
     // time step
     Real dt;
     
     amrex::GpuArray<amrex::Real, 3> prob_lo; // physical lo coordinate
     amrex::GpuArray<amrex::Real, 3> prob_hi; // physical hi coordinate
 
-    amrex::GpuArray<amrex::Real, 3> mag_lo; // physical lo coordinate of magnetic region
-    amrex::GpuArray<amrex::Real, 3> mag_hi; // physical hi coordinate of magnetic region
-
     Real Phi_Bc_hi;
     Real Phi_Bc_lo;
 
     int TimeIntegratorOrder;
 
-    // Magnetic Properties
-    Real alpha_val, gamma_val, Ms_val, exchange_val, anisotropy_val;
+    // error tolerance of the adaptive integrator (relative to Ms), and optional end time
+    Real adaptive_tol;
+    Real stop_time;
+
+    // energy minimization in place of the time loop, stopping at max |m x H_eff| < relax_tol * Ms
+    int relax;
+    Real relax_tol;
+    int relax_maxiter;
+
+    // hysteresis loop: relax at each field point of sweep.*, warm-started from the last one
+    int sweep;
+
+    // adaptive mesh refinement with the levels and tagging of amr.*
+    int amr;
+
+    // per-phase timing summary written to perf_file every perf_int steps, and the
+    // per-step FAB memory report
+    int perf_int;
+    std::string perf_file;
+    int mem_report;
+
+    // stop the time loop early once M is in equilibrium, checked every stop_int steps
+    int stop_int;
+    Real stop_dMdt_tol, stop_torque_tol, stop_energy_tol;
+
+    // semi-implicit (IMEX) exchange in place of the explicit integrator
+    int implicit_exchange;
+    Real implicit_exchange_tol;
+
+    // Poisson tolerance for the MLMG demag path, adapted to the change in M per step
+    Real poisson_tol_min, poisson_tol_max, poisson_tol_factor;
+    int mlmg_verbosity;
+
+    // Magnetic Properties; the materials and their regions are read by Materials
     Real mu0;
     amrex::GpuArray<amrex::Real, 3> anisotropy_axis; 
 
 
     int demag_coupling;
+    int demag_solver;
+    int demag_benchmark;
+    int sparse_execution;
+    int llg_kernel_benchmark;
+    int thread_scaling_benchmark;
+    int M_layout;
     int M_normalization;
     int exchange_coupling;
     int anisotropy_coupling;
@@ -89,20 +195,62 @@ void main_main ()
 
 	pp.get("TimeIntegratorOrder",TimeIntegratorOrder);
 
+        adaptive_tol = 1.e-5;
+        pp.query("adaptive_tol", adaptive_tol);
+
+        // If stop_time > 0 the run ends at stop_time or after nsteps, whichever comes first
+        stop_time = -1.;
+        pp.query("stop_time", stop_time);
+
+        implicit_exchange = 0;
+        pp.query("implicit_exchange", implicit_exchange);
+        implicit_exchange_tol = 1.e-8;
+        pp.query("implicit_exchange_tol", implicit_exchange_tol);
+
+        // relative tolerance = poisson_tol_factor * max|dM|/Ms, clamped to [poisson_tol_min, poisson_tol_max]
+        poisson_tol_min = 1.e-10;
+        pp.query("poisson_tol_min", poisson_tol_min);
+        poisson_tol_max = 1.e-4;
+        pp.query("poisson_tol_max", poisson_tol_max);
+        poisson_tol_factor = 1.e-2;
+        pp.query("poisson_tol_factor", poisson_tol_factor);
+        mlmg_verbosity = 1;
+        pp.query("mlmg_verbosity", mlmg_verbosity);
+
         // Material Properties
 	
         pp.get("mu0",mu0);
-        pp.get("alpha_val",alpha_val);
-        pp.get("gamma_val",gamma_val);
-        pp.get("Ms_val",Ms_val);
-        pp.get("exchange_val",exchange_val);
-        pp.get("anisotropy_val",anisotropy_val);
 
         pp.get("demag_coupling",demag_coupling);
         pp.get("M_normalization", M_normalization);
         pp.get("exchange_coupling", exchange_coupling);
         pp.get("anisotropy_coupling", anisotropy_coupling);
 
+        // Demag engine: 0 = FFT convolution, 1 = MLMG solve for the magnetostatic potential
+        demag_solver = 0;
+        pp.query("demag_solver", demag_solver);
+
+        // Compare the FFT demag field against direct summation once at startup
+        demag_benchmark = 0;
+        pp.query("demag_benchmark", demag_benchmark);
+
+        // Restrict all field storage and updates to the boxes holding magnetic cells
+        sparse_execution = 0;
+        pp.query("sparse_execution", sparse_execution);
+
+        // Time the specialized LLG kernels against the runtime-flag kernel once at startup
+        llg_kernel_benchmark = 0;
+        pp.query("llg_kernel_benchmark", llg_kernel_benchmark);
+
+        // Time the LLG update from 1 to the maximum number of OpenMP threads once at startup
+        thread_scaling_benchmark = 0;
+        pp.query("thread_scaling_benchmark", thread_scaling_benchmark);
+
+        // Storage of M: 0 = one MultiFab per component, 1 = one 3-component MultiFab
+        // per state, so the components of a cell share an allocation and a box
+        M_layout = 1;
+        pp.query("M_layout", M_layout);
+
 
         // Default nsteps to 10, allow us to set it to something else in the inputs file
         nsteps = 10;
@@ -113,6 +261,64 @@ void main_main ()
         plot_int = -1;
         pp.query("plot_int",plot_int);
 
+        // Static variables (alpha, Ms, gamma, exchange, anisotropy, material and, for a uniform
+        // constant applied field, H*_bias) are only written at step 0; Mx, My, Mz and, with demag,
+        // H*_demag are written every plot_int steps
+        plot_vars = {"alpha", "Ms", "gamma", "exchange", "anisotropy", "Mx", "My", "Mz",
+                     "Hx_bias", "Hy_bias", "Hz_bias"};
+        pp.queryarr("plot_vars", plot_vars);
+
+        // Default chk_int to -1 (no checkpoints)
+        chk_int = -1;
+        pp.query("chk_int", chk_int);
+        chk_nfiles = 64;
+        pp.query("chk_nfiles", chk_nfiles);
+        chk_poisson_phi = 1;
+        pp.query("chk_poisson_phi", chk_poisson_phi);
+        restart_chkfile = "";
+        pp.query("restart", restart_chkfile);
+
+        // Default relax to 0 (time-evolve M with LLG)
+        relax = 0;
+        pp.query("relax", relax);
+        relax_tol = 1.e-5;
+        pp.query("relax_tol", relax_tol);
+        relax_maxiter = 10000;
+        pp.query("relax_maxiter", relax_maxiter);
+
+        // Default sweep to 0 (no hysteresis loop)
+        sweep = 0;
+        pp.query("sweep", sweep);
+
+        // Default amr to 0 (a single level of n_cell cells)
+        amr = 0;
+        pp.query("amr", amr);
+
+        // Default perf_int to -1 (no JSON summary)
+        perf_int = -1;
+        pp.query("perf_int", perf_int);
+        perf_file = "perf_summary.json";
+        pp.query("perf_file", perf_file);
+        // Default mem_report to 0; 1 reduces and prints FAB memory use every step
+        mem_report = 0;
+        pp.query("mem_report", mem_report);
+
+        // Default stop_int to -1 (always run nsteps); a tolerance <= 0 disables its criterion
+        stop_int = -1;
+        pp.query("stop_int", stop_int);
+        stop_dMdt_tol = 0.;
+        pp.query("stop_dMdt_tol", stop_dMdt_tol);
+        stop_torque_tol = 0.;
+        pp.query("stop_torque_tol", stop_torque_tol);
+        stop_energy_tol = 0.;
+        pp.query("stop_energy_tol", stop_energy_tol);
+
+        // Default diag_int to -1 (no diagnostics)
+        diag_int = -1;
+        pp.query("diag_int", diag_int);
+        diag_file = "diagnostics.csv";
+        pp.query("diag_file", diag_file);
+
         // time step
         pp.get("dt",dt);
 
@@ -128,16 +334,6 @@ void main_main ()
             }
         }
 
-        if (pp.queryarr("mag_lo",temp)) {
-            for (int i=0; i<AMREX_SPACEDIM; ++i) {
-                mag_lo[i] = temp[i];
-            }
-        }
-        if (pp.queryarr("mag_hi",temp)) {
-            for (int i=0; i<AMREX_SPACEDIM; ++i) {
-                mag_hi[i] = temp[i];
-            }
-        }
         if (pp.queryarr("anisotropy_axis",temp)) {
             for (int i=0; i<AMREX_SPACEDIM; ++i) {
                 anisotropy_axis[i] = temp[i];
@@ -182,6 +378,33 @@ void main_main ()
     // extract dx from the geometry object
     GpuArray<Real,AMREX_SPACEDIM> dx = geom.CellSizeArray();
 
+    // AMR mode builds its own grid hierarchy on this domain and runs its own time loop
+    if (amr == 1)
+    {
+#ifdef MICROMAG_MIXED_PRECISION
+        amrex::Abort("amr = 1 interpolates M in Real precision; build without MICROMAG_MIXED_PRECISION");
+#else
+        if (implicit_exchange == 1 || sparse_execution == 1 || relax == 1 || sweep == 1
+            || !restart_chkfile.empty() || (demag_coupling == 1 && demag_solver == 1))
+        {
+            amrex::Abort("amr = 1 runs the explicit integrators with FFT demag: set implicit_exchange, "
+                         "sparse_execution, relax, sweep and demag_solver to 0, without restart");
+        }
+
+        AmrMicroMag amr_mag(real_box, Vector<int>{AMREX_D_DECL(n_cell[0], n_cell[1], n_cell[2])}, is_periodic,
+                            max_grid_size, mu0, demag_coupling, exchange_coupling, anisotropy_coupling,
+                            M_normalization, anisotropy_axis, TimeIntegratorOrder);
+        amr_mag.InitData();
+        amr_mag.Evolve(nsteps, dt, stop_time, plot_int, diag_int, diag_file);
+
+        Real total_step_stop_time = ParallelDescriptor::second() - total_step_strt_time;
+        ParallelDescriptor::ReduceRealMax(total_step_stop_time);
+
+        amrex::Print() << "Total run time " << total_step_stop_time << " seconds\n";
+#endif
+        return;
+    }
+
     // Nghost = number of ghost cells for each array
     int Nghost = 1;
 
@@ -191,54 +414,140 @@ void main_main ()
     // How Boxes are distrubuted among MPI processes
     DistributionMapping dm(ba);
 
-    // Allocate multifabs
+    // material ID of every cell and the constants of each material
+    Materials materials(geom, ba, dm, Nghost, mu0);
+    materials.checkCouplings(exchange_coupling, anisotropy_coupling);
+    MaterialTable const& mat = materials.table();
 
-    Array<MultiFab, AMREX_SPACEDIM> Mfield;
-    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
-    {
-        Mfield[dir].define(ba, dm, Ncomp, Nghost);
+    // scale of the tolerances relative to Ms
+    Real const Ms_max = materials.maxMs();
+
+    // H_bias and the profiled applied field, evaluated in the kernels
+    AppliedField applied(geom);
+
+    // stochastic thermal field of temperature > 0, integrated with stochastic Heun
+    ThermalField thermal(materials, geom, mu0);
+    if (thermal.enabled() && (TimeIntegratorOrder != 2 || implicit_exchange == 1)) {
+        amrex::Abort("temperature > 0 needs the stochastic Heun scheme: TimeIntegratorOrder = 2 and implicit_exchange = 0");
     }
 
-    Array<MultiFab, AMREX_SPACEDIM> Mfield_old;
-    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    // In sparse mode, the magnetization, fields and material data live only on the
+    // parts of the boxes that hold magnetic cells, so every update, copy and ghost
+    // exchange below scales with the magnet volume
+    BoxArray ba_mag = ba;
+    DistributionMapping dm_mag = dm;
+    if (sparse_execution == 1)
     {
-        Mfield_old[dir].define(ba, dm, Ncomp, Nghost);
+        ba_mag = MagneticBoxArray(materials.id());
+        dm_mag = DistributionMapping(ba_mag);
+
+        materials.restrictTo(ba_mag, dm_mag, geom);
+
+        amrex::Print() << "Sparse execution on " << ba_mag.size() << " boxes, "
+                       << ba_mag.numPts() << " of " << ba.numPts() << " cells\n";
     }
 
-    Array<MultiFab, AMREX_SPACEDIM> Hfield;
+    // Mfield and Mfield_old are swapped at the start of every step rather than copied.
+    // With M_layout = 1 each component is an alias into a 3-component MultiFab.
+    MagMultiFab M_storage;
+    MagMultiFab M_old_storage;
+    Array<MagMultiFab, AMREX_SPACEDIM> Mfield;
+    Array<MagMultiFab, AMREX_SPACEDIM> Mfield_old;
+    if (M_layout == 1)
+    {
+        M_storage.define(ba_mag, dm_mag, AMREX_SPACEDIM, Nghost);
+        M_old_storage.define(ba_mag, dm_mag, AMREX_SPACEDIM, Nghost);
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            Mfield[dir] = MagMultiFab(M_storage, amrex::make_alias, dir, 1);
+            Mfield_old[dir] = MagMultiFab(M_old_storage, amrex::make_alias, dir, 1);
+        }
+    } else {
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            Mfield[dir].define(ba_mag, dm_mag, Ncomp, Nghost);
+            Mfield_old[dir].define(ba_mag, dm_mag, Ncomp, Nghost);
+        }
+    }
+    // ghost cells at non-periodic boundaries are never written by the integrators,
+    // so both buffers must start from zero there
     for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
     {
-        Hfield[dir].define(ba, dm, Ncomp, Nghost);
+        Mfield[dir].setVal(0.);
+        Mfield_old[dir].setVal(0.);
     }
 
-    Array<MultiFab, AMREX_SPACEDIM> H_biasfield;
-    for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+    // ghost exchange of M, overlapped with the LLG update of interior cells
+    MagnetizationHalo halo(geom);
+    if (M_layout == 1)
     {
-        H_biasfield[dir].define(ba, dm, Ncomp, Nghost);
+        halo.addPacked(Mfield, M_storage);
+        halo.addPacked(Mfield_old, M_old_storage);
     }
 
-    MultiFab alpha(ba, dm, Ncomp, Nghost);
-    MultiFab gamma(ba, dm, Ncomp, Nghost);
-    MultiFab Ms(ba, dm, Ncomp, Nghost);
-    MultiFab exchange(ba, dm, Ncomp, Nghost);
-    MultiFab anisotropy(ba, dm, Ncomp, Nghost);
+    // neighbor mask and inverse spacings of the exchange Laplacian
+    ExchangeStencil exchange_stencil(materials.id(), geom);
+
+    // the demag field is only stored when demag is coupled; the applied field is
+    // evaluated in the LLG kernel instead of being stored
+    Array<MagMultiFab, AMREX_SPACEDIM> Hfield;
+    if (demag_coupling == 1)
+    {
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            Hfield[dir].define(ba_mag, dm_mag, Ncomp, Nghost);
+            Hfield[dir].setVal(0.);
+        }
+    }
 
     amrex::Print() << "==================== Initial Setup ====================\n";
     amrex::Print() << " demag_coupling      = " << demag_coupling      << "\n";
+    amrex::Print() << " demag_solver        = " << demag_solver        << "\n";
     amrex::Print() << " M_normalization     = " << M_normalization     << "\n";
     amrex::Print() << " exchange_coupling   = " << exchange_coupling   << "\n";
     amrex::Print() << " anisotropy_coupling = " << anisotropy_coupling << "\n";
-    amrex::Print() << " Ms                  = " << Ms_val              << "\n";
-    amrex::Print() << " alpha               = " << alpha_val           << "\n";
-    amrex::Print() << " gamma               = " << gamma_val           << "\n";
-    amrex::Print() << " exchange_value      = " << exchange_val        << "\n";
-    amrex::Print() << " anisotropy_value    = " << anisotropy_val      << "\n";
+    amrex::Print() << " M_layout            = " << M_layout            << "\n";
+    amrex::Print() << " M, H storage        = " << ((sizeof(MagReal) == sizeof(float)) ? "single" : "double") << " precision\n";
+    materials.print();
+    applied.print();
+    thermal.print();
     amrex::Print() << "=======================================================\n";
 
     MultiFab PoissonRHS(ba, dm, 1, 0);
     MultiFab PoissonPhi(ba, dm, 1, 1);
 
-    MultiFab Plt(ba, dm, 11, 0);
+    PlotOutput plot_output(geom, ba, dm, plot_vars);
+    // material constants are looked up from the ID field only when a plotfile is written
+    for (std::string const name : {"alpha", "Ms", "gamma", "exchange", "anisotropy", "material"})
+    {
+        plot_output.addStatic(name, materials.id(), materials.values(name));
+    }
+    // Mfield is swapped with Mfield_old in place, so these always see the current state
+    plot_output.addDynamic("Mx", Mfield[0]);
+    plot_output.addDynamic("My", Mfield[1]);
+    plot_output.addDynamic("Mz", Mfield[2]);
+    // the applied field is only written once when it is uniform and constant
+    if (applied.isUniform() && applied.isConstant() && sweep == 0)
+    {
+        plot_output.addStatic("Hx_bias", applied.H_bias[0]);
+        plot_output.addStatic("Hy_bias", applied.H_bias[1]);
+        plot_output.addStatic("Hz_bias", applied.H_bias[2]);
+    }
+    else
+    {
+        for (int dir = 0; dir < 3; dir++)
+        {
+            plot_output.addDynamic(std::string("H") + "xyz"[dir] + "_bias",
+                                   [&applied, dir] (MultiFab& mf, int comp, Real t) { applied.fill(mf, comp, dir, t); });
+        }
+    }
+    if (demag_coupling == 1)
+    {
+        plot_output.addDynamic("Hx_demag", Hfield[0]);
+        plot_output.addDynamic("Hy_demag", Hfield[1]);
+        plot_output.addDynamic("Hz_demag", Hfield[2]);
+    }
+    if (plot_int > 0) plot_output.checkSelection();
 
     //Solver for Poisson equation
     LPInfo info;
@@ -292,346 +601,530 @@ void main_main ()
 
     //Declare MLMG object
     MLMG mlmg(mlabec);
-    mlmg.setVerbose(2);
+    mlmg.setVerbose(mlmg_verbosity);
+
+    // FFT-based demagnetization solver; builds the padded FFT plans and the
+    // transformed Newell tensor once
+    std::unique_ptr<Demagnetization> demag_fft;
+    if ((demag_coupling == 1 && demag_solver == 0) || demag_benchmark == 1)
+    {
+        demag_fft = std::make_unique<Demagnetization>(geom, max_grid_size);
+    }
+
+    // Solve Poisson's equation laplacian(Phi) = div(M) and get Hfield = -grad(Phi).
+    // The operator and MLMG object above are reused for every solve, and PoissonPhi
+    // keeps the previous solution as the initial guess.
+    long poisson_iters = 0;
+    int poisson_solves = 0;
+
+    // in sparse mode the Poisson solve still runs on the whole domain
+    Array<MagMultiFab, AMREX_SPACEDIM> M_domain;
+    Array<MagMultiFab, AMREX_SPACEDIM> H_domain;
+    if (sparse_execution == 1 && demag_coupling == 1 && demag_solver == 1)
+    {
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            M_domain[dir].define(ba, dm, 1, 1);
+            H_domain[dir].define(ba, dm, 1, 0);
+        }
+    }
+
+    auto ComputeHDemagPoisson = [&] (Array<MagMultiFab, AMREX_SPACEDIM>& M, Real tol_rel)
+    {
+        if (sparse_execution == 1)
+        {
+            for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+            {
+                M_domain[dir].setVal(0.);
+                M_domain[dir].ParallelCopy(M[dir], 0, 0, 1, 0, 1, geom.periodicity());
+            }
+            ComputePoissonRHS(PoissonRHS, M_domain, geom);
+        } else {
+            ComputePoissonRHS(PoissonRHS, M, geom);
+        }
+
+        mlmg.solve({&PoissonPhi}, {&PoissonRHS}, tol_rel, -1);
+        PoissonPhi.FillBoundary(geom.periodicity());
+
+        if (sparse_execution == 1)
+        {
+            ComputeHfromPhi(PoissonPhi, H_domain, prob_lo, prob_hi, geom);
+            for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+            {
+                Hfield[dir].ParallelCopy(H_domain[dir], 0, 0, 1);
+            }
+        } else {
+            ComputeHfromPhi(PoissonPhi, Hfield, prob_lo, prob_hi, geom);
+        }
+
+        poisson_iters += mlmg.getNumIters();
+        ++poisson_solves;
+    };
 
     // time = starting time in the simulation
     Real time = 0.0;	
    
     //Next steps (06/16/2022: Initialze M, solve Poisson's equation for Phi, Compute H from Phi, H_exchane and H_anisotropy from M)
 
-    InitializeMagneticProperties(alpha, Ms, gamma, exchange, anisotropy,
-                                 alpha_val, Ms_val, gamma_val, exchange_val, anisotropy_val, 
-                                 prob_lo, prob_hi, mag_lo, mag_hi, geom);
-
     //Initialize fields
 
-    //for (MFIter mfi(*Mfield[0]); mfi.isValid(); ++mfi)
-    for (MFIter mfi(Mfield[0]); mfi.isValid(); ++mfi)
+    // valid cells only; ghost cells are filled by FillBoundary below and stay zero
+    // at non-periodic boundaries
+    InitializeM(Mfield, materials, geom);
+
+    // step of the initial state; a restart continues from the checkpoint
+    int restart_step = 0;
+
+    // largest change of M over the previous step, relative to Ms
+    Real dM_rel = 0.;
+
+    bool phi_restored = false;
+    if (!restart_chkfile.empty())
     {
-    
-          const Box& bx = mfi.growntilebox(1); 
-
-    // extract field data
-          Array4<Real> const &Mx = Mfield[0].array(mfi);         
-          Array4<Real> const &My = Mfield[1].array(mfi);         
-          Array4<Real> const &Mz = Mfield[2].array(mfi);
-         
-          Array4<Real> const &Hx_bias = H_biasfield[0].array(mfi);
-          Array4<Real> const &Hy_bias = H_biasfield[1].array(mfi);
-          Array4<Real> const &Hz_bias = H_biasfield[2].array(mfi);
-      
-          Array4<Real> const &Hx = Hfield[0].array(mfi);
-          Array4<Real> const &Hy = Hfield[1].array(mfi);
-          Array4<Real> const &Hz = Hfield[2].array(mfi);
-              
-          const Array4<Real>& Ms_arr = Ms.array(mfi);
-
-
-          amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
-          {
-             Hx_bias(i,j,k) = 0._rt;         
-             Hy_bias(i,j,k) = 3.7e4;
-             Hz_bias(i,j,k) = 0._rt;
-
-
-             if (Ms_arr(i,j,k) > 0._rt)
-             {
-
-//               Mx(i,j,k) = 1.4e5;
-//               My(i,j,k) = 0.;
-//               Mz(i,j,k) = 0.;
-                Real x = prob_lo[0] + (i+0.5) * dx[0];
-                Real y = prob_lo[1] + (j+0.5) * dx[1];
-                Real z = prob_lo[2] + (k+0.5) * dx[2];
-                
-                Mx(i,j,k) = (y < 0) ? 1.4e5 : 0.;
-                My(i,j,k) = 0._rt;
-                Mz(i,j,k) = (y >= 0) ? 1.4e5 : 0.;
-             } else {
-	       Mx(i,j,k) = 0.0;
-	       My(i,j,k) = 0.0;
-	       Mz(i,j,k) = 0.0;
-	     }
-
-             if(demag_coupling == 1)
-             { 
-//             //Solve Poisson's equation laplacian(Phi) = div(M) and get Hfield = -grad(Phi)
-//       	//Compute RHS of Poisson equation
-//      	ComputePoissonRHS(PoissonRHS, Mfield, 
-//      			mag_lo, mag_hi, 
-//      			prob_lo, prob_hi, 
-//      			geom);
-//
-//              //Initial guess for phi
-//              PoissonPhi.setVal(0.);
-//              mlmg.solve({&PoissonPhi}, {&PoissonRHS}, 1.e-10, -1);
-//      
-//              // Calculate H from Phi
-//      
-//      	ComputeHfromPhi(PoissonPhi, Hx, Hy, Hz, prob_lo, prob_hi, geom);
-//      
-               //Hx = ;
-               //Hy = ;
-               //Hz = ;
-             }
-          });
+        phi_restored = ReadCheckpoint(restart_chkfile, restart_step, time, dt, dM_rel, Mfield,
+                                      (demag_coupling == 1 && demag_solver == 1) ? &PoissonPhi : nullptr,
+                                      geom);
+    }
+
+    for (int comp = 0; comp < 3; comp++)
+    {
+        Mfield[comp].FillBoundary(geom.periodicity());
+    }
+
+    if (demag_coupling == 1)
+    {
+        if (demag_solver == 1) {
+            // a restored potential is the initial guess
+            if (!phi_restored) {
+                PoissonPhi.setVal(0.);
+                SetPhiBC_z(PoissonPhi, n_cell, Phi_Bc_lo, Phi_Bc_hi);
+            }
+            ComputeHDemagPoisson(Mfield, poisson_tol_min);
+        } else {
+            demag_fft->ComputeHDemag(Mfield, Hfield);
+        }
+    }
+
+    if (demag_benchmark == 1)
+    {
+        DemagBenchmark(*demag_fft, Mfield, materials.id(), geom);
+    }
 
-    } 
- 
     // Write a plotfile of the initial data if plot_int > 0
-    if (plot_int > 0)
-    {
-        int step = 0;
-        const std::string& pltfile = amrex::Concatenate("plt",step,8);
-        MultiFab::Copy(Plt, alpha, 0, 0, 1, 0);  
-        MultiFab::Copy(Plt, Ms, 0, 1, 1, 0);
-        MultiFab::Copy(Plt, gamma, 0, 2, 1, 0);
-        MultiFab::Copy(Plt, exchange, 0, 3, 1, 0);
-        MultiFab::Copy(Plt, anisotropy, 0, 4, 1, 0);
-        MultiFab::Copy(Plt, Mfield[0], 0, 5, 1, 0);
-        MultiFab::Copy(Plt, Mfield[1], 0, 6, 1, 0);
-        MultiFab::Copy(Plt, Mfield[2], 0, 7, 1, 0);
-        MultiFab::Copy(Plt, H_biasfield[0], 0, 8, 1, 0);
-        MultiFab::Copy(Plt, H_biasfield[1], 0, 9, 1, 0);
-        MultiFab::Copy(Plt, H_biasfield[2], 0, 10, 1, 0);
-        WriteSingleLevelPlotfile(pltfile, Plt, {"alpha","Ms","gamma","exchange","anisotropy","Mx", "My", "Mz", "Hx_bias", "Hy_bias", "Hz_bias"}, geom, time, 0);
+    if (plot_int > 0 && restart_step == 0)
+    {
+        plot_output.write(0, time);
+    }
+
+    // LLG kernel specialized for this run's coupling flags
+    LLGRHSFunction ComputeLLGRHS = SelectLLGRHS(demag_coupling, exchange_coupling, anisotropy_coupling, M_normalization,
+                                                thermal.enabled());
+
+    if (llg_kernel_benchmark == 1 || thread_scaling_benchmark == 1)
+    {
+        Array<MagMultiFab, AMREX_SPACEDIM> LLG_RHS;
+        for (int dir = 0; dir < AMREX_SPACEDIM; dir++)
+        {
+            LLG_RHS[dir].define(ba_mag, dm_mag, 1, 0);
+        }
+        if (llg_kernel_benchmark == 1)
+        {
+            LLGKernelBenchmark(LLG_RHS, Mfield, Hfield, applied, materials, exchange_stencil,
+                               mu0, anisotropy_axis, geom, 20);
+        }
+        if (thread_scaling_benchmark == 1)
+        {
+            ThreadScalingBenchmark(ComputeLLGRHS, LLG_RHS, Mfield, Hfield, applied, materials,
+                                   exchange_stencil, mu0, anisotropy_axis, M_normalization, geom, 20);
+        }
     }
 
-    for (int step = 1; step <= nsteps; ++step)
+    // phase timers of the time loop, with the bytes each phase must move per call; the
+    // bandwidth the JSON summary reports against is only measured when it is written
+    PerfMonitor perf(ba_mag, dm_mag, perf_int > 0);
+    // M, H and the slopes are MagReal; the material enters as one int ID per cell
+    Real const rhs_bytes = perf.cells() * (sizeof(MagReal) * (6 + 3*demag_coupling) + sizeof(int)
+                                           + sizeof(int) * exchange_coupling);
+    Real const update_bytes = perf.cells() * 9 * sizeof(MagReal);
+    Real const normalize_bytes = perf.cells() * (6 * sizeof(MagReal) + sizeof(int));
+    Real const halo_bytes = 2. * AMREX_SPACEDIM * sizeof(MagReal)
+                          * static_cast<Real>(BoxArray(ba_mag).grow(Nghost).numPts() - ba_mag.numPts());
+    long rhs_evals = 0;
+
+    // Right-hand side of the LLG equation, including the demag field of the state M.
+    // The ghost exchange of M runs while the FFT demag field and the interior cells
+    // are computed; only the cells next to box faces wait for it.
+    auto ComputeHDemag = [&] (Array<MagMultiFab, AMREX_SPACEDIM>& M)
     {
-        // copy new solution into old solution
-        for(int comp = 0; comp < 3; comp++)
+        PerfMonitor::Timer timer(perf, PerfMonitor::Demag);
+        if (demag_solver == 1) {
+            BL_PROFILE("ComputeHDemagPoisson");
+            // div M reads the ghost cells
+            halo.finish();
+            // the field only needs to be as accurate as the change M made over the last step;
+            // relax and sweep take no time steps, so dM_rel is never updated and every
+            // iteration solves to poisson_tol_min
+            Real tol_rel = (relax == 1 || sweep == 1)
+                ? poisson_tol_min
+                : amrex::max(poisson_tol_min, amrex::min(poisson_tol_max, poisson_tol_factor * dM_rel));
+            ComputeHDemagPoisson(M, tol_rel);
+        } else {
+            demag_fft->ComputeHDemag(M, Hfield);
+        }
+    };
+
+    auto EvaluateLLG = [&] (Array<MagMultiFab, AMREX_SPACEDIM>& M, Array<MagMultiFab, AMREX_SPACEDIM>& dMdt, Real t)
+    {
+        ++rhs_evals;
+
+        {
+            PerfMonitor::Timer timer(perf, PerfMonitor::HaloExchange, halo_bytes);
+            halo.start(M);
+        }
+
+        if (demag_coupling == 1)
+        {
+            ComputeHDemag(M);
+        }
+
+        {
+            PerfMonitor::Timer timer(perf, PerfMonitor::FieldAssembly, rhs_bytes);
+            ComputeLLGRHS(dMdt, M, Hfield, applied, t, thermal, materials, exchange_stencil,
+                          mu0, anisotropy_axis, geom, TileRegion::Interior);
+        }
+
+        {
+            PerfMonitor::Timer timer(perf, PerfMonitor::HaloExchange);
+            halo.finish();
+        }
+
         {
-           MultiFab::Copy(Mfield_old[comp], Mfield[comp], 0, 0, 1, 1);
+            PerfMonitor::Timer timer(perf, PerfMonitor::FieldAssembly);
+            ComputeLLGRHS(dMdt, M, Hfield, applied, t, thermal, materials, exchange_stencil,
+                          mu0, anisotropy_axis, geom, TileRegion::Boundary);
+        }
+    };
+
+    // diagnostics of the current Mfield, with its ghost cells and demag field brought up to date
+    auto CurrentDiagnostics = [&] ()
+    {
+        halo.start(Mfield);
+        halo.finish();
+        if (demag_coupling == 1)
+        {
+            ComputeHDemag(Mfield);
+        }
+        return ComputeDiagnostics(Mfield, Hfield, applied, time, materials, exchange_stencil,
+                                  demag_coupling, exchange_coupling, anisotropy_coupling,
+                                  mu0, anisotropy_axis, geom);
+    };
 
-           // fill periodic ghost cells
-           Mfield_old[comp].FillBoundary(geom.periodicity());
+    auto WriteDiagnosticsStep = [&] (int step)
+    {
+        WriteDiagnostics(diag_file, step, time, CurrentDiagnostics());
+    };
+
+    if (diag_int > 0)
+    {
+        InitDiagnosticsFile(diag_file, restart_step > 0);
+        if (restart_step == 0) WriteDiagnosticsStep(0);
+    }
 
+    // relaxation direction of the energy minimization, for relax and the field sweep
+    LLGRHSFunction ComputeRelaxDirection = SelectRelaxDirection(demag_coupling, exchange_coupling, anisotropy_coupling);
+
+    auto EvaluateRelaxDirection = [&] (Array<MagMultiFab, AMREX_SPACEDIM>& M, Array<MagMultiFab, AMREX_SPACEDIM>& G)
+    {
+        halo.start(M);
+
+        if (demag_coupling == 1)
+        {
+            ComputeHDemag(M);
         }
 
+        ComputeRelaxDirection(G, M, Hfield, applied, time, thermal, materials, exchange_stencil,
+                              mu0, anisotropy_axis, geom, TileRegion::Interior);
+
+        halo.finish();
+
+        ComputeRelaxDirection(G, M, Hfield, applied, time, thermal, materials, exchange_stencil,
+                              mu0, anisotropy_axis, geom, TileRegion::Boundary);
+    };
+
+    // relax to the nearest energy minimum and write it out instead of time-evolving M
+    int last_step = nsteps;
+    if (relax == 1)
+    {
+        Real relax_strt_time = ParallelDescriptor::second();
+
+        Relaxation relaxation(ba_mag, dm_mag, relax_tol, relax_maxiter);
+        int const niter = relaxation.Relax(Mfield, materials, EvaluateRelaxDirection);
+
+        Real relax_stop_time = ParallelDescriptor::second() - relax_strt_time;
+        ParallelDescriptor::ReduceRealMax(relax_stop_time);
+
+        amrex::Print() << (relaxation.converged() ? "Relaxation converged in " : "Relaxation stopped after ")
+                       << niter << " iterations, max torque " << relaxation.maxTorque() << " A/m, "
+                       << relax_stop_time << " seconds\n";
+
+        // outputs of the relaxed state are numbered by iteration
+        int const relax_step = restart_step + niter;
+        if (plot_int > 0)
+        {
+            plot_output.write(relax_step, time);
+        }
+        if (diag_int > 0)
+        {
+            WriteDiagnosticsStep(relax_step);
+        }
+        if (chk_int > 0)
+        {
+            WriteCheckpoint(amrex::Concatenate("chk",relax_step,8), relax_step, time, dt, dM_rel, Mfield,
+                            (demag_coupling == 1 && demag_solver == 1 && chk_poisson_phi == 1) ? &PoissonPhi : nullptr,
+                            chk_nfiles);
+        }
+
+        last_step = restart_step;
+    }
+
+    // hysteresis loop in place of the time loop; each point starts from the equilibrium
+    // of the previous one, so only the first point relaxes from the initial state
+    if (sweep == 1)
+    {
+        FieldSweep field_sweep;
+        field_sweep.initFile();
+
+        Relaxation relaxation(ba_mag, dm_mag, relax_tol, relax_maxiter);
+
+        Real sweep_strt_time = ParallelDescriptor::second();
+        long sweep_iter = 0;
+
+        for (int p = 0; p < field_sweep.numPoints(); ++p)
+        {
+            Real point_strt_time = ParallelDescriptor::second();
+
+            applied.H_bias = field_sweep.point(p);
+            int const niter = relaxation.Relax(Mfield, materials, EvaluateRelaxDirection);
+            sweep_iter += niter;
+
+            MagneticDiagnostics const diag = CurrentDiagnostics();
+
+            Real point_time = ParallelDescriptor::second() - point_strt_time;
+            ParallelDescriptor::ReduceRealMax(point_time);
+
+            field_sweep.write(p, diag, niter, relaxation.converged(), point_time);
+
+            amrex::Print() << "Field point " << p << ": H = (" << applied.H_bias[0] << ", " << applied.H_bias[1]
+                           << ", " << applied.H_bias[2] << "), <M> = (" << diag.M_avg[0] << ", " << diag.M_avg[1]
+                           << ", " << diag.M_avg[2] << "), " << niter << " iterations"
+                           << (relaxation.converged() ? "" : " (not converged)") << ", " << point_time << " seconds\n";
+
+            if (field_sweep.plotInterval() > 0 && p%field_sweep.plotInterval() == 0)
+            {
+                plot_output.write(p, time, "sweep");
+            }
+        }
+
+        Real sweep_time = ParallelDescriptor::second() - sweep_strt_time;
+        ParallelDescriptor::ReduceRealMax(sweep_time);
+
+        amrex::Print() << "Field sweep of " << field_sweep.numPoints() << " points in " << sweep_iter
+                       << " iterations, " << sweep_time << " seconds\n";
+
+        last_step = restart_step;
+    }
+
+    TimeIntegrator integrator(TimeIntegratorOrder, ba_mag, dm_mag, Nghost);
+    integrator.setTolerance(adaptive_tol, Ms_max);
+    if (integrator.stageStorage())
+    {
+        halo.addPacked(integrator.stageState(), *integrator.stageStorage());
+    }
+
+    // reference time of a blocking exchange for the hidden-communication report
+    halo.calibrate(Mfield, 10);
+
+    // the stiffest material sets the exchange limit; <= 0 if any material is unstable at every dt
+    auto MaterialsExchangeStableDt = [&] (int order)
+    {
+        Real dt_min = std::numeric_limits<Real>::max();
+        for (int m = 1; m <= materials.numMaterials(); ++m)
+        {
+            Real const dt_m = ExchangeStableDt(order, mat.alpha[m], mat.gamma[m], mat.Ms[m], mat.exchange[m], dx);
+            if (dt_m <= 0.) return dt_m;
+            dt_min = amrex::min(dt_min, dt_m);
+        }
+        return dt_min;
+    };
+
+    std::unique_ptr<ImplicitExchange> implicit_solver;
+    if (implicit_exchange == 1)
+    {
+        if (TimeIntegratorOrder != 1) amrex::Abort("implicit_exchange = 1 is a first-order IMEX scheme; set TimeIntegratorOrder = 1");
+        if (exchange_coupling != 1) amrex::Abort("implicit_exchange = 1 requires exchange_coupling = 1");
+        for (int m = 1; m <= materials.numMaterials(); ++m) {
+            if (mat.alpha[m] <= 0.) amrex::Abort("implicit_exchange = 1 requires alpha > 0 in every material");
+        }
+        if (sparse_execution == 1) amrex::Abort("implicit_exchange = 1 needs the whole domain; set sparse_execution = 0");
+        implicit_solver = std::make_unique<ImplicitExchange>(geom, ba, dm, materials, implicit_exchange_tol);
+        amrex::Print() << "Implicit exchange dt = " << dt << ", explicit Euler limit would be "
+                       << MaterialsExchangeStableDt(1) << "\n";
+    }
+
+    // explicit exchange limits dt through the stiffest, grid-scale exchange mode
+    if (exchange_coupling == 1 && implicit_exchange == 0)
+    {
+        Real dt_exchange = MaterialsExchangeStableDt(TimeIntegratorOrder);
+        if (dt_exchange > 0.) {
+            amrex::Print() << "Exchange stability limit dt = " << dt_exchange << "\n";
+            integrator.setMaxDt(dt_exchange);
+            if (dt > dt_exchange) {
+                amrex::Print() << "Reducing dt from " << dt << " to the exchange stability limit\n";
+                dt = dt_exchange;
+            }
+        } else {
+            amrex::Print() << "Warning: TimeIntegratorOrder " << TimeIntegratorOrder
+                           << " is unstable for undamped exchange modes at any dt\n";
+        }
+    }
+
+    ConvergenceMonitor convergence(stop_dMdt_tol, stop_torque_tol, stop_energy_tol, Ms_max);
+    if (stop_int > 0 && !convergence.enabled())
+    {
+        amrex::Print() << "Warning: stop_int > 0 but every stop_*_tol is <= 0; running all nsteps\n";
+    }
+
+    for (int step = restart_step + 1; step <= last_step; ++step)
+    {
+        // the new solution becomes the old one; Advance overwrites every valid cell of
+        // Mfield, so swapping the buffers (and the storage they alias) replaces a full copy
+        std::swap(Mfield, Mfield_old);
+        std::swap(M_storage, M_old_storage);
+
         Real step_strt_time = ParallelDescriptor::second();
 
     	    // Evolve M
 
+        if (stop_time > 0. && time + dt > stop_time) dt = stop_time - time;
 
-        //for (MFIter mfi(*Mfield[0]); mfi.isValid(); ++mfi)
-        for (MFIter mfi(Mfield[0]); mfi.isValid(); ++mfi)
-        {
-       
-              const Box& bx = mfi.growntilebox(1); 
-
-        // extract field data
-              Array4<Real> const &Hx = Hfield[0].array(mfi);
-              Array4<Real> const &Hy = Hfield[1].array(mfi);
-              Array4<Real> const &Hz = Hfield[2].array(mfi);
-              Array4<Real> const &Mx = Mfield[0].array(mfi);         
-              Array4<Real> const &My = Mfield[1].array(mfi);         
-              Array4<Real> const &Mz = Mfield[2].array(mfi);         
-              Array4<Real> const &Mx_old = Mfield_old[0].array(mfi); 
-              Array4<Real> const &My_old = Mfield_old[1].array(mfi); 
-              Array4<Real> const &Mz_old = Mfield_old[2].array(mfi); 
-              Array4<Real> const &Hx_bias = H_biasfield[0].array(mfi);
-              Array4<Real> const &Hy_bias = H_biasfield[1].array(mfi);
-              Array4<Real> const &Hz_bias = H_biasfield[2].array(mfi);
-          
-              const Array4<Real>& alpha_arr = alpha.array(mfi);
-              const Array4<Real>& gamma_arr = gamma.array(mfi);
-              const Array4<Real>& Ms_arr = Ms.array(mfi);
-              const Array4<Real>& exchange_arr = exchange.array(mfi);
-              const Array4<Real>& anisotropy_arr = anisotropy.array(mfi);
- 
-              amrex::ParallelFor( bx, [=] AMREX_GPU_DEVICE (int i, int j, int k)
-              {
-                 if (Ms_arr(i,j,k) > 0._rt)
-                 {
-                    amrex::Real Hx_eff = Hx_bias(i,j,k);
-                    amrex::Real Hy_eff = Hy_bias(i,j,k);
-                    amrex::Real Hz_eff = Hz_bias(i,j,k);
-                 
-                    if(demag_coupling == 1)
-                    {
-                      Hx_eff += Hx(i,j,k);
-                      Hy_eff += Hy(i,j,k);
-                      Hz_eff += Hz(i,j,k);
-                    }
-
-                    if(exchange_coupling == 1)
-                    { 
-                    //Add exchange term
-                      if (exchange_arr(i,j,k) == 0._rt) amrex::Abort("The exchange_arr(i,j,k) is 0.0 while including the exchange coupling term H_exchange for H_eff");
-
-                      // H_exchange - use M^(old_time)
-                      amrex::Real const H_exchange_coeff = 2.0 * exchange_arr(i,j,k) / mu0 / Ms_arr(i,j,k) / Ms_arr(i,j,k);
-
-                      amrex::Real Ms_lo_x = Ms_arr(i-1, j, k); 
-                      amrex::Real Ms_hi_x = Ms_arr(i+1, j, k); 
-                      amrex::Real Ms_lo_y = Ms_arr(i, j-1, k); 
-                      amrex::Real Ms_hi_y = Ms_arr(i, j+1, k); 
-                      amrex::Real Ms_lo_z = Ms_arr(i, j, k-1);
-                      amrex::Real Ms_hi_z = Ms_arr(i, j, k+1);
-
-		      if(i == 31 && j == 31 && k == 31) amrex::Print() << "Laplacia_x = " <<  Laplacian_Mag(Mx_old, Ms_lo_x, Ms_hi_x, Ms_lo_y, Ms_hi_y, Ms_lo_z, Ms_hi_z, i, j, k, geom) << "/n";
-                      Hx_eff += H_exchange_coeff * Laplacian_Mag(Mx_old, Ms_lo_x, Ms_hi_x, Ms_lo_y, Ms_hi_y, Ms_lo_z, Ms_hi_z, i, j, k, geom);
-                      Hy_eff += H_exchange_coeff * Laplacian_Mag(My_old, Ms_lo_x, Ms_hi_x, Ms_lo_y, Ms_hi_y, Ms_lo_z, Ms_hi_z, i, j, k, geom);
-                      Hz_eff += H_exchange_coeff * Laplacian_Mag(Mz_old, Ms_lo_x, Ms_hi_x, Ms_lo_y, Ms_hi_y, Ms_lo_z, Ms_hi_z, i, j, k, geom);
-
-                    }
-                 
-                    if(anisotropy_coupling == 1)
-                    {
-                     //Add anisotropy term
- 
-                     if (anisotropy_arr(i,j,k) == 0._rt) amrex::Abort("The anisotropy_arr(i,j,k) is 0.0 while including the anisotropy coupling term H_anisotropy for H_eff");
-
-                      // H_anisotropy - use M^(old_time)
-                      amrex::Real M_dot_anisotropy_axis = 0.0;
-                      M_dot_anisotropy_axis = Mx(i, j, k) * anisotropy_axis[0] + My(i, j, k) * anisotropy_axis[1] + Mz(i, j, k) * anisotropy_axis[2];
-                      amrex::Real const H_anisotropy_coeff = - 2.0 * anisotropy_arr(i,j,k) / mu0 / Ms_arr(i,j,k) / Ms_arr(i,j,k);
-                      Hx_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[0];
-                      Hy_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[1];
-                      Hz_eff += H_anisotropy_coeff * M_dot_anisotropy_axis * anisotropy_axis[2];
-
-                    }
-
-                   //Update M
-
-                   amrex::Real mag_gammaL = gamma_arr(i,j,k) / (1._rt + std::pow(alpha_arr(i,j,k), 2._rt));
-
-                   // 0 = unsaturated; compute |M| locally.  1 = saturated; use M_s 
-                   amrex::Real M_magnitude = (M_normalization == 0) ? std::sqrt(std::pow(Mx(i, j, k), 2._rt) + std::pow(My(i, j, k), 2._rt) + std::pow(Mz(i, j, k), 2._rt))
-                                                             : Ms_arr(i,j,k);
-                   amrex::Real Gil_damp = mu0 * mag_gammaL * alpha_arr(i,j,k) / M_magnitude;
-
-                   // x component on cell-centers
-                   Mx(i, j, k) += dt * (mu0 * mag_gammaL) * (My_old(i, j, k) * Hz_eff - Mz_old(i, j, k) * Hy_eff)
-                                        + dt * Gil_damp * (My_old(i, j, k) * (Mx_old(i, j, k) * Hy_eff - My_old(i, j, k) * Hx_eff)
-                                        - Mz_old(i, j, k) * (Mz_old(i, j, k) * Hx_eff - Mx_old(i, j, k) * Hz_eff));
-
-                   // y component on cell-centers
-                   My(i, j, k) += dt * (mu0 * mag_gammaL) * (Mz_old(i, j, k) * Hx_eff - Mx_old(i, j, k) * Hz_eff)
-                                        + dt * Gil_damp * (Mz_old(i, j, k) * (My_old(i, j, k) * Hz_eff - Mz_old(i, j, k) * Hy_eff)
-                                        - Mx_old(i, j, k) * (Mx_old(i, j, k) * Hy_eff - My_old(i, j, k) * Hx_eff));
-
-                   // z component on cell-centers
-                   Mz(i, j, k) += dt * (mu0 * mag_gammaL) * (Mx_old(i, j, k) * Hy_eff - My_old(i, j, k) * Hx_eff)
-                                        + dt * Gil_damp * (Mx_old(i, j, k) * (Mz_old(i, j, k) * Hx_eff - Mx_old(i, j, k) * Hz_eff)
-                                        - My_old(i, j, k) * (My_old(i, j, k) * Hz_eff - Mz_old(i, j, k) * Hy_eff));
-  
-
-                   // temporary normalized magnitude of M_xface field at the fixed point
-                   amrex::Real M_magnitude_normalized = std::sqrt(std::pow(Mx(i, j, k), 2._rt) + std::pow(My(i, j, k), 2._rt) + std::pow(Mz(i, j, k), 2._rt)) / Ms_arr(i,j,k);
-
-                       
-                   amrex::Real normalized_error = 0.1;
-
-                   if (M_normalization > 0)
-                   {
-                       // saturated case; if |M| has drifted from M_s too much, abort.  Otherwise, normalize
-                       // check the normalized error
-                       if (amrex::Math::abs(1._rt - M_magnitude_normalized) > normalized_error)
-                       {
-                           amrex::Print() << "M_magnitude_normalized = " << M_magnitude_normalized << "\n";
-                           amrex::Abort("Exceed the normalized error of the Mx field");
-                       }
-                       // normalize the M field
-                       Mx(i, j, k) /= M_magnitude_normalized;
-                       My(i, j, k) /= M_magnitude_normalized;
-                       Mz(i, j, k) /= M_magnitude_normalized;
-                   }
-                   else if (M_normalization == 0)
-                   {   
-		       if(i == 1 && j == 1 && k == 1)amrex::Print() << "Here ????" << "\n";
-                       // check the normalized error
-                       if (M_magnitude_normalized > (1._rt + normalized_error))
-                       {
-                           amrex::Abort("Caution: Unsaturated material has M_xface exceeding the saturation magnetization");
-                       }
-                       else if (M_magnitude_normalized > 1._rt && M_magnitude_normalized <= (1._rt + normalized_error) )
-                       {
-                           // normalize the M field
-                           Mx(i, j, k) /= M_magnitude_normalized;
-                           My(i, j, k) /= M_magnitude_normalized;
-                           Mz(i, j, k) /= M_magnitude_normalized;
-                       }
-                   }
-
-                 }   
- 
-              });     
-                      
-     }  
-	
-//        // copy new solution into old solution
-//        for(int comp = 0; comp < 3; comp++)
-//        {
-//           MultiFab::Copy(Mfield_old[comp], Mfield[comp], 0, 0, 1, 1);
-//
-//           // fill periodic ghost cells
-//           Mfield_old[comp].FillBoundary(geom.periodicity());
-//
-//        }
-
-//             //Solve Poisson's equation laplacian(Phi) = div(M) and get Hfield = -grad(Phi)
-//       	//Compute RHS of Poisson equation
-//      	ComputePoissonRHS(PoissonRHS, Mfield, 
-//      			mag_lo, mag_hi, 
-//      			prob_lo, prob_hi, 
-//      			geom);
-//
-//              //Initial guess for phi
-//              PoissonPhi.setVal(0.);
-//              mlmg.solve({&PoissonPhi}, {&PoissonRHS}, 1.e-10, -1);
-//      
-//              // Calculate H from Phi
-//      
-//      	ComputeHfromPhi(PoissonPhi, Hx, Hy, Hz, prob_lo, prob_hi, geom);
-//      
+        // one thermal field per step, shared by the stages
+        if (thermal.enabled()) thermal.setStep(step, dt);
+
+        Real dt_step = dt;
+        {
+            // the right-hand side evaluations inside are timed as their own phases
+            PerfMonitor::Timer timer(perf, PerfMonitor::Update);
+            long const evals_before = rhs_evals;
+            if (implicit_exchange == 1) {
+                implicit_solver->Advance(Mfield, Mfield_old, EvaluateLLG, time, dt);
+            } else {
+                dt_step = integrator.Advance(Mfield, Mfield_old, EvaluateLLG, time, dt);
+            }
+            timer.addBytes(update_bytes * (rhs_evals - evals_before));
+        }
+
+        {
+            PerfMonitor::Timer timer(perf, PerfMonitor::Normalize, normalize_bytes);
+            NormalizeM(Mfield, materials, M_normalization);
+        }
+
+        if (demag_coupling == 1 && demag_solver == 1)
+        {
+            dM_rel = MaxMagnetizationChange(Mfield, Mfield_old) / Ms_max;
+        }
 
 	Real step_stop_time = ParallelDescriptor::second() - step_strt_time;
         ParallelDescriptor::ReduceRealMax(step_stop_time);
 
-        amrex::Print() << "Advanced step " << step << " in " << step_stop_time << " seconds\n";
+        if (integrator.isAdaptive()) {
+            amrex::Print() << "Advanced step " << step << " with dt = " << dt_step << " in " << step_stop_time << " seconds\n";
+        } else {
+            amrex::Print() << "Advanced step " << step << " in " << step_stop_time << " seconds\n";
+        }
 
         // update time
-        time = time + dt;
+        time = time + dt_step;
+
+        bool const reached_stop_time = (stop_time > 0. && time >= stop_time);
+
+        // the convergence check and the diagnostics share one evaluation of the state
+        // a changing applied field keeps driving M, so equilibrium only counts once it is
+        // steady; thermal fluctuations never settle
+        bool const check_convergence = (stop_int > 0 && convergence.enabled() && step%stop_int == 0
+                                        && time >= applied.steadyAfter() && !thermal.enabled());
+        bool converged = false;
+        MagneticDiagnostics diag;
+        bool const have_diag = check_convergence || (diag_int > 0 && step%diag_int == 0);
+        if (have_diag)
+        {
+            PerfMonitor::Timer timer(perf, PerfMonitor::IO);
+            diag = CurrentDiagnostics();
+        }
+        if (check_convergence)
+        {
+            // Mfield_old still holds the state at the start of this step
+            Real const dMdt_max = MaxMagnetizationChange(Mfield, Mfield_old) / dt_step;
+            converged = convergence.check(dMdt_max, diag);
+            if (converged) {
+                amrex::Print() << "Converged at step " << step << ": " << convergence.reason() << "\n";
+            }
+        }
+
+        bool const last = reached_stop_time || converged;
 
-        if (plot_int > 0 && step%plot_int == 0)
         {
-            const std::string& pltfile = amrex::Concatenate("plt",step,8);
-            MultiFab::Copy(Plt, alpha, 0, 0, 1, 0);  
-            MultiFab::Copy(Plt, Ms, 0, 1, 1, 0);
-            MultiFab::Copy(Plt, gamma, 0, 2, 1, 0);
-            MultiFab::Copy(Plt, exchange, 0, 3, 1, 0);
-            MultiFab::Copy(Plt, anisotropy, 0, 4, 1, 0);
-            MultiFab::Copy(Plt, Mfield[0], 0, 5, 1, 0);
-            MultiFab::Copy(Plt, Mfield[1], 0, 6, 1, 0);
-            MultiFab::Copy(Plt, Mfield[2], 0, 7, 1, 0);
-            MultiFab::Copy(Plt, H_biasfield[0], 0, 8, 1, 0);
-            MultiFab::Copy(Plt, H_biasfield[1], 0, 9, 1, 0);
-            MultiFab::Copy(Plt, H_biasfield[2], 0, 10, 1, 0);
-            WriteSingleLevelPlotfile(pltfile, Plt, {"alpha","Ms","gamma","exchange","anisotropy","Mx", "My", "Mz", "Hx_bias", "Hy_bias", "Hz_bias"}, geom, time, step);
+            PerfMonitor::Timer timer(perf, PerfMonitor::IO);
+
+            if (plot_int > 0 && (step%plot_int == 0 || last))
+            {
+                plot_output.write(step, time);
+            }
+
+            if (diag_int > 0 && (step%diag_int == 0 || last))
+            {
+                WriteDiagnostics(diag_file, step, time, have_diag ? diag : CurrentDiagnostics());
+            }
+
+            if (chk_int > 0 && (step%chk_int == 0 || last))
+            {
+                WriteCheckpoint(amrex::Concatenate("chk",step,8), step, time, dt, dM_rel, Mfield,
+                                (demag_coupling == 1 && demag_solver == 1 && chk_poisson_phi == 1) ? &PoissonPhi : nullptr,
+                                chk_nfiles);
+            }
         }
 
-        // MultiFab memory usage
-        const int IOProc = ParallelDescriptor::IOProcessorNumber();
+        perf.stepDone(ParallelDescriptor::second() - step_strt_time);
 
-        amrex::Long min_fab_megabytes  = amrex::TotalBytesAllocatedInFabsHWM()/1048576;
-        amrex::Long max_fab_megabytes  = min_fab_megabytes;
+        if (perf_int > 0 && (step%perf_int == 0 || last || step == last_step))
+        {
+            perf.writeJSON(perf_file, step);
+        }
+
+        // MultiFab memory usage; the reductions are skipped unless requested
+        if (mem_report == 1)
+        {
+            const int IOProc = ParallelDescriptor::IOProcessorNumber();
 
-        ParallelDescriptor::ReduceLongMin(min_fab_megabytes, IOProc);
-        ParallelDescriptor::ReduceLongMax(max_fab_megabytes, IOProc);
+            amrex::Long min_fab_megabytes  = amrex::TotalBytesAllocatedInFabsHWM()/1048576;
+            amrex::Long max_fab_megabytes  = min_fab_megabytes;
 
-        amrex::Print() << "High-water FAB megabyte spread across MPI nodes: ["
-                       << min_fab_megabytes << " ... " << max_fab_megabytes << "]\n";
+            ParallelDescriptor::ReduceLongMin(min_fab_megabytes, IOProc);
+            ParallelDescriptor::ReduceLongMax(max_fab_megabytes, IOProc);
 
-        min_fab_megabytes  = amrex::TotalBytesAllocatedInFabs()/1048576;
-        max_fab_megabytes  = min_fab_megabytes;
+            amrex::Print() << "High-water FAB megabyte spread across MPI nodes: ["
+                           << min_fab_megabytes << " ... " << max_fab_megabytes << "]\n";
 
-        ParallelDescriptor::ReduceLongMin(min_fab_megabytes, IOProc);
-        ParallelDescriptor::ReduceLongMax(max_fab_megabytes, IOProc);
+            min_fab_megabytes  = amrex::TotalBytesAllocatedInFabs()/1048576;
+            max_fab_megabytes  = min_fab_megabytes;
 
-        amrex::Print() << "Curent     FAB megabyte spread across MPI nodes: ["
-                       << min_fab_megabytes << " ... " << max_fab_megabytes << "]\n";
+            ParallelDescriptor::ReduceLongMin(min_fab_megabytes, IOProc);
+            ParallelDescriptor::ReduceLongMax(max_fab_megabytes, IOProc);
+
+            amrex::Print() << "Curent     FAB megabyte spread across MPI nodes: ["
+                           << min_fab_megabytes << " ... " << max_fab_megabytes << "]\n";
+        }
+
+        if (last) break;
 
     }
     
@@ -639,4 +1132,28 @@ void main_main ()
         ParallelDescriptor::ReduceRealMax(total_step_stop_time);
 
         amrex::Print() << "Total run time " << total_step_stop_time << " seconds\n";
+
+        if (integrator.isAdaptive())
+        {
+            amrex::Print() << "Rejected adaptive steps " << integrator.numRejected() << "\n";
+        }
+
+        if (implicit_exchange == 1)
+        {
+            amrex::Print() << "Implicit exchange average MLMG iterations per solve "
+                           << implicit_solver->averageIterations() << "\n";
+        }
+
+        halo.report();
+
+        if (plot_int > 0)
+        {
+            amrex::Print() << "Time spent in plotfile output " << plot_output.writeTime() << " seconds\n";
+        }
+
+        if (poisson_solves > 0)
+        {
+            amrex::Print() << "Poisson solves " << poisson_solves << ", average V-cycles per solve "
+                           << static_cast<Real>(poisson_iters) / poisson_solves << "\n";
+        }
 }